@@ -0,0 +1,396 @@
+/*
+ *  ChronOS i/o scheduler.
+ *
+ *  Requests are dispatched earliest deadline first. A request submitted by a
+ *  SCHED_CHRONOS task carries the deadline of the task's segment, or the one
+ *  it has inherited, and every other request is given a deadline of
+ *  read_expire or write_expire after it was submitted. Best-effort I/O thus only
+ *  ever waits behind requests with earlier deadlines, and is not starved by a
+ *  stream of real-time I/O. A bio merged into a queued request brings its
+ *  deadline along if it is the earlier one.
+ *
+ *  Copyright (C) 2009-2012 Virginia Tech Real Time Systems Lab
+ */
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/compiler.h>
+#include <linux/rbtree.h>
+#include <linux/time.h>
+#include <linux/chronos_util.h>
+
+static const int read_expire = 500;	/* deadline of best-effort reads, ms */
+static const int write_expire = 5000;	/* ditto for writes */
+
+struct chronos_io_data {
+	/*
+	 * requests are present on both sort_list and edf_list
+	 */
+	struct rb_root sort_list[2];
+	struct list_head edf_list;
+
+	/*
+	 * settings that change how the i/o scheduler behaves
+	 */
+	int fifo_expire[2];
+	int front_merges;
+};
+
+/*
+ * The deadline of a request is kept in its elevator_private pointers
+ */
+static inline void chronos_get_deadline(struct request *rq, struct timespec *ts)
+{
+	ts->tv_sec = (long)rq->elevator_private[0];
+	ts->tv_nsec = (long)rq->elevator_private[1];
+}
+
+static inline void chronos_set_deadline(struct request *rq, struct timespec *ts)
+{
+	rq->elevator_private[0] = (void *)ts->tv_sec;
+	rq->elevator_private[1] = (void *)ts->tv_nsec;
+}
+
+/*
+ * deadline of i/o issued by current in direction data_dir
+ */
+static void
+chronos_task_deadline(struct chronos_io_data *cd, int data_dir, struct timespec *ts)
+{
+	struct rt_info *r = &current->rtinfo;
+
+	if (current->policy == SCHED_CHRONOS && !is_zero_ts(pi_deadline(r))) {
+		*ts = *pi_deadline(r);
+		return;
+	}
+
+	getnstimeofday(ts);
+	timespec_add_ns(ts, (u64)cd->fifo_expire[data_dir] * NSEC_PER_MSEC);
+}
+
+static inline struct rb_root *
+chronos_rb_root(struct chronos_io_data *cd, struct request *rq)
+{
+	return &cd->sort_list[rq_data_dir(rq)];
+}
+
+/*
+ * insert rq into edf_list. New requests mostly have the latest deadline,
+ * so search from the back.
+ */
+static void chronos_add_rq_edf(struct chronos_io_data *cd, struct request *rq)
+{
+	struct timespec deadline, ts;
+	struct request *__rq;
+
+	chronos_get_deadline(rq, &deadline);
+
+	list_for_each_entry_reverse(__rq, &cd->edf_list, queuelist) {
+		chronos_get_deadline(__rq, &ts);
+		if (timespec_compare(&ts, &deadline) <= 0) {
+			list_add(&rq->queuelist, &__rq->queuelist);
+			return;
+		}
+	}
+
+	list_add(&rq->queuelist, &cd->edf_list);
+}
+
+/*
+ * remove rq from rbtree and edf_list.
+ */
+static void chronos_remove_request(struct request_queue *q, struct request *rq)
+{
+	struct chronos_io_data *cd = q->elevator->elevator_data;
+
+	list_del_init(&rq->queuelist);
+	elv_rb_del(chronos_rb_root(cd, rq), rq);
+}
+
+/*
+ * move request from sort list to dispatch queue.
+ */
+static void chronos_move_to_dispatch(struct request_queue *q, struct request *rq)
+{
+	chronos_remove_request(q, rq);
+	elv_dispatch_add_tail(q, rq);
+}
+
+static void
+chronos_add_rq_rb(struct chronos_io_data *cd, struct request *rq)
+{
+	struct rb_root *root = chronos_rb_root(cd, rq);
+	struct request *__alias;
+
+	while (unlikely(__alias = elv_rb_add(root, rq)))
+		chronos_move_to_dispatch(rq->q, __alias);
+}
+
+/*
+ * stamp rq with the deadline of the task allocating it, which is the one
+ * submitting the i/o. Requests are often only added to the queue later, on
+ * unplug and from another task.
+ */
+static int
+chronos_set_request(struct request_queue *q, struct request *rq, gfp_t gfp_mask)
+{
+	struct chronos_io_data *cd = q->elevator->elevator_data;
+	struct timespec deadline;
+
+	chronos_task_deadline(cd, rq_data_dir(rq), &deadline);
+	chronos_set_deadline(rq, &deadline);
+	return 0;
+}
+
+/*
+ * add rq to rbtree and edf_list. Requests allocated while the elevator was
+ * being switched were never stamped, so they are given one here.
+ */
+static void
+chronos_add_request(struct request_queue *q, struct request *rq)
+{
+	struct chronos_io_data *cd = q->elevator->elevator_data;
+	struct timespec deadline;
+
+	chronos_add_rq_rb(cd, rq);
+
+	if (!(rq->cmd_flags & REQ_ELVPRIV)) {
+		chronos_task_deadline(cd, rq_data_dir(rq), &deadline);
+		chronos_set_deadline(rq, &deadline);
+	}
+	chronos_add_rq_edf(cd, rq);
+}
+
+static int
+chronos_merge(struct request_queue *q, struct request **req, struct bio *bio)
+{
+	struct chronos_io_data *cd = q->elevator->elevator_data;
+	struct request *__rq;
+	sector_t sector;
+
+	/*
+	 * back merges are found by the elevator core, check for front merge
+	 */
+	if (cd->front_merges) {
+		sector = bio->bi_sector + bio_sectors(bio);
+
+		__rq = elv_rb_find(&cd->sort_list[bio_data_dir(bio)], sector);
+		if (__rq) {
+			BUG_ON(sector != blk_rq_pos(__rq));
+
+			if (elv_rq_merge_ok(__rq, bio)) {
+				*req = __rq;
+				return ELEVATOR_FRONT_MERGE;
+			}
+		}
+	}
+
+	return ELEVATOR_NO_MERGE;
+}
+
+static void chronos_merged_request(struct request_queue *q,
+				   struct request *req, int type)
+{
+	struct chronos_io_data *cd = q->elevator->elevator_data;
+
+	/*
+	 * if the merge was a front merge, we need to reposition request
+	 */
+	if (type == ELEVATOR_FRONT_MERGE) {
+		elv_rb_del(chronos_rb_root(cd, req), req);
+		chronos_add_rq_rb(cd, req);
+	}
+}
+
+/*
+ * a bio was merged into rq, which inherits its deadline if that is earlier.
+ * Requests still on a plug list have not been given one yet.
+ */
+static void chronos_bio_merged(struct request_queue *q, struct request *rq,
+			       struct bio *bio)
+{
+	struct chronos_io_data *cd = q->elevator->elevator_data;
+	struct timespec deadline, ts;
+
+	if (!(rq->cmd_flags & REQ_SORTED))
+		return;
+
+	chronos_task_deadline(cd, bio_data_dir(bio), &deadline);
+	chronos_get_deadline(rq, &ts);
+
+	if (timespec_compare(&deadline, &ts) < 0) {
+		list_del_init(&rq->queuelist);
+		chronos_set_deadline(rq, &deadline);
+		chronos_add_rq_edf(cd, rq);
+	}
+}
+
+static void
+chronos_merged_requests(struct request_queue *q, struct request *req,
+			struct request *next)
+{
+	struct timespec deadline, ts;
+
+	/*
+	 * if next has the earlier deadline, assign it to rq and move into
+	 * next position (next will be deleted) in edf_list
+	 */
+	chronos_get_deadline(next, &deadline);
+	chronos_get_deadline(req, &ts);
+
+	if (timespec_compare(&deadline, &ts) < 0) {
+		list_move(&req->queuelist, &next->queuelist);
+		chronos_set_deadline(req, &deadline);
+	}
+
+	/*
+	 * kill knowledge of next, this one is a goner
+	 */
+	chronos_remove_request(q, next);
+}
+
+/*
+ * dispatch the request with the earliest deadline
+ */
+static int chronos_dispatch_requests(struct request_queue *q, int force)
+{
+	struct chronos_io_data *cd = q->elevator->elevator_data;
+
+	if (list_empty(&cd->edf_list))
+		return 0;
+
+	chronos_move_to_dispatch(q, rq_entry_fifo(cd->edf_list.next));
+
+	return 1;
+}
+
+static void chronos_exit_queue(struct elevator_queue *e)
+{
+	struct chronos_io_data *cd = e->elevator_data;
+
+	BUG_ON(!list_empty(&cd->edf_list));
+
+	kfree(cd);
+}
+
+/*
+ * initialize elevator private data (chronos_io_data).
+ */
+static void *chronos_init_queue(struct request_queue *q)
+{
+	struct chronos_io_data *cd;
+
+	cd = kmalloc_node(sizeof(*cd), GFP_KERNEL | __GFP_ZERO, q->node);
+	if (!cd)
+		return NULL;
+
+	INIT_LIST_HEAD(&cd->edf_list);
+	cd->sort_list[READ] = RB_ROOT;
+	cd->sort_list[WRITE] = RB_ROOT;
+	cd->fifo_expire[READ] = read_expire;
+	cd->fifo_expire[WRITE] = write_expire;
+	cd->front_merges = 1;
+	return cd;
+}
+
+/*
+ * sysfs parts below
+ */
+
+static ssize_t
+chronos_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+chronos_var_store(int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtol(p, &p, 10);
+	return count;
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR)					\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct chronos_io_data *cd = e->elevator_data;			\
+	return chronos_var_show(__VAR, (page));				\
+}
+SHOW_FUNCTION(chronos_read_expire_show, cd->fifo_expire[READ]);
+SHOW_FUNCTION(chronos_write_expire_show, cd->fifo_expire[WRITE]);
+SHOW_FUNCTION(chronos_front_merges_show, cd->front_merges);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX)				\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct chronos_io_data *cd = e->elevator_data;			\
+	int __data;							\
+	int ret = chronos_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	*(__PTR) = __data;						\
+	return ret;							\
+}
+STORE_FUNCTION(chronos_read_expire_store, &cd->fifo_expire[READ], 0, INT_MAX);
+STORE_FUNCTION(chronos_write_expire_store, &cd->fifo_expire[WRITE], 0, INT_MAX);
+STORE_FUNCTION(chronos_front_merges_store, &cd->front_merges, 0, 1);
+#undef STORE_FUNCTION
+
+#define CD_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, chronos_##name##_show, \
+				      chronos_##name##_store)
+
+static struct elv_fs_entry chronos_attrs[] = {
+	CD_ATTR(read_expire),
+	CD_ATTR(write_expire),
+	CD_ATTR(front_merges),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_chronos = {
+	.ops = {
+		.elevator_merge_fn = 		chronos_merge,
+		.elevator_merged_fn =		chronos_merged_request,
+		.elevator_merge_req_fn =	chronos_merged_requests,
+		.elevator_bio_merged_fn =	chronos_bio_merged,
+		.elevator_dispatch_fn =		chronos_dispatch_requests,
+		.elevator_add_req_fn =		chronos_add_request,
+		.elevator_set_req_fn =		chronos_set_request,
+		.elevator_former_req_fn =	elv_rb_former_request,
+		.elevator_latter_req_fn =	elv_rb_latter_request,
+		.elevator_init_fn =		chronos_init_queue,
+		.elevator_exit_fn =		chronos_exit_queue,
+	},
+
+	.elevator_attrs = chronos_attrs,
+	.elevator_name = "chronos",
+	.elevator_owner = THIS_MODULE,
+};
+
+static int __init chronos_iosched_init(void)
+{
+	elv_register(&iosched_chronos);
+
+	return 0;
+}
+
+static void __exit chronos_iosched_exit(void)
+{
+	elv_unregister(&iosched_chronos);
+}
+
+module_init(chronos_iosched_init);
+module_exit(chronos_iosched_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("ChronOS deadline IO scheduler");
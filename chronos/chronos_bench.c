@@ -0,0 +1,493 @@
+/* chronos/chronos_bench.c
+ *
+ * In-kernel latency benchmark for ChronOS schedulers
+ *
+ * Sets a scheduler on a set of CPUs through set_scheduler_mask(), then spawns
+ * periodic kernel threads which run real ChronOS segments under it. The
+ * results are reported as histograms in /proc/chronos/bench:
+ *
+ *	release_lat	- release-to-start latency of every job
+ *	preempt_lat	- release-to-start latency of jobs which were released
+ *			  while a ChronOS segment was running on the releasing
+ *			  CPU, and hence required a preemption
+ *	pull_lat	- release-to-start latency of jobs which started on a
+ *			  different CPU than they were released on, and hence
+ *			  went through the global pull path
+ *	tardiness	- tardiness of jobs which missed their deadline
+ *
+ * All histograms have 1us buckets. Example, GFIFO on CPUs 0-3:
+ *	insmod chronos_bench.ko sched=0x80 cpus=0xf threads=4 loops=10000
+ *
+ * Copyright (C) 2009-2012 Virginia Tech Real Time Systems Lab
+ */
+
+#include <linux/cpumask.h>
+#include <linux/hrtimer.h>
+#include <linux/kthread.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/proc_fs.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/time.h>
+#include <linux/chronos_types.h>
+#include <linux/chronos_sched.h>
+#include <linux/chronos_util.h>
+
+#define BENCH_HIST_BUCKETS	1000
+/* Gaps larger than this inside the busy loop are time we spent preempted */
+#define BENCH_GAP_NS		5000
+
+static int sched = SCHED_RT_FIFO;
+module_param(sched, int, 0444);
+MODULE_PARM_DESC(sched, "Scheduler number, as passed to set_scheduler");
+
+static int flags = SCHED_FLAG_NONE;
+module_param(flags, int, 0444);
+MODULE_PARM_DESC(flags, "Scheduler flags, as passed to set_scheduler");
+
+static int prio = 50;
+module_param(prio, int, 0444);
+MODULE_PARM_DESC(prio, "Priority of the domain and of the benchmark segments");
+
+static ulong cpus;
+module_param(cpus, ulong, 0444);
+MODULE_PARM_DESC(cpus, "Mask of CPUs to run on (default: all online)");
+
+static int threads;
+module_param(threads, int, 0444);
+MODULE_PARM_DESC(threads, "Number of periodic threads (default: one per CPU)");
+
+static int period_us = 1000;
+module_param(period_us, int, 0444);
+MODULE_PARM_DESC(period_us, "Period of the first thread in us");
+
+static int interval_us = 500;
+module_param(interval_us, int, 0444);
+MODULE_PARM_DESC(interval_us, "Period increment for each following thread in us");
+
+static int exec_us = 100;
+module_param(exec_us, int, 0444);
+MODULE_PARM_DESC(exec_us, "Execution time of each job in us");
+
+static int loops = 10000;
+module_param(loops, int, 0444);
+MODULE_PARM_DESC(loops, "Number of jobs each thread releases");
+
+struct bench_hist {
+	unsigned long bucket[BENCH_HIST_BUCKETS];
+	unsigned long overflow;
+	unsigned long count;
+	long min;
+	long max;
+	long long sum;
+};
+
+struct bench_thread {
+	struct task_struct *task;
+	struct hrtimer timer;
+	struct timespec release;
+	struct timespec period;
+	/* Filled in by the release timer */
+	int released;
+	int release_cpu;
+	int release_preempt;
+	/* Results */
+	unsigned long jobs;
+	unsigned long misses;
+	int error;			/* why the thread stopped early */
+	struct bench_hist release_lat;
+	struct bench_hist preempt_lat;
+	struct bench_hist pull_lat;
+	struct bench_hist tardiness;
+};
+
+static struct bench_thread **bench;
+static int nr_bench;
+static cpumask_t bench_mask;
+static int bench_global;
+
+static void bench_hist_init(struct bench_hist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = LONG_MAX;
+}
+
+static void bench_hist_add(struct bench_hist *h, long us)
+{
+	if(us < 0)
+		us = 0;
+
+	if(us < BENCH_HIST_BUCKETS)
+		h->bucket[us]++;
+	else
+		h->overflow++;
+
+	if(us < h->min)
+		h->min = us;
+	if(us > h->max)
+		h->max = us;
+
+	h->count++;
+	h->sum += us;
+}
+
+static void bench_hist_merge(struct bench_hist *to, struct bench_hist *from)
+{
+	int i;
+
+	for(i = 0; i < BENCH_HIST_BUCKETS; i++)
+		to->bucket[i] += from->bucket[i];
+
+	to->overflow += from->overflow;
+	to->count += from->count;
+	to->sum += from->sum;
+	if(from->min < to->min)
+		to->min = from->min;
+	if(from->max > to->max)
+		to->max = from->max;
+}
+
+/* Microseconds from t1 to t2, negative if t2 is before t1 */
+static long bench_delta_us(struct timespec *t1, struct timespec *t2)
+{
+	return (t2->tv_sec - t1->tv_sec) * MILLION +
+		(t2->tv_nsec - t1->tv_nsec) / THOUSAND;
+}
+
+static enum hrtimer_restart bench_release(struct hrtimer *timer)
+{
+	struct bench_thread *t = container_of(timer, struct bench_thread, timer);
+
+	/* The timer need not fire on the CPU the thread slept on, so look at
+	 * what is running there, which this release has to preempt */
+	t->release_cpu = task_cpu(t->task);
+	t->release_preempt = chronos_cpu_in_segment(t->release_cpu);
+	t->released = 1;
+	wake_up_process(t->task);
+
+	return HRTIMER_NORESTART;
+}
+
+static void bench_wait_release(struct bench_thread *t)
+{
+	t->released = 0;
+	set_current_state(TASK_INTERRUPTIBLE);
+	hrtimer_start(&t->timer, timespec_to_ktime(t->release), HRTIMER_MODE_ABS);
+
+	while(!t->released && !kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+
+	__set_current_state(TASK_RUNNING);
+	hrtimer_cancel(&t->timer);
+}
+
+/* Burn exec_us of CPU time, not counting time we spend preempted */
+static void bench_burn(void)
+{
+	s64 done = 0, delta;
+	ktime_t last = ktime_get(), now;
+
+	while(done < (s64)exec_us * THOUSAND) {
+		now = ktime_get();
+		delta = ktime_to_ns(ktime_sub(now, last));
+		if(delta < BENCH_GAP_NS)
+			done += delta;
+		last = now;
+		cpu_relax();
+	}
+}
+
+static int bench_thread_fn(void *data)
+{
+	struct bench_thread *t = data;
+	struct timespec start, end, deadline;
+	long lat;
+	int ret;
+
+	getnstimeofday(&t->release);
+	add_ts(&t->release, &t->period, &t->release);
+
+	while(t->jobs < loops && !kthread_should_stop()) {
+		bench_wait_release(t);
+		if(!t->released)
+			break;
+
+		add_ts(&t->release, &t->period, &deadline);
+		ret = _begin_rt_seg(current, &current->rtinfo, &deadline, &t->period,
+				    exec_us, 1, prio);
+		if(ret) {
+			t->error = ret;
+			break;
+		}
+
+		getnstimeofday(&start);
+		lat = bench_delta_us(&t->release, &start);
+		bench_hist_add(&t->release_lat, lat);
+		if(t->release_preempt)
+			bench_hist_add(&t->preempt_lat, lat);
+		if(raw_smp_processor_id() != t->release_cpu)
+			bench_hist_add(&t->pull_lat, lat);
+
+		bench_burn();
+
+		getnstimeofday(&end);
+		_end_rt_seg(current, &current->rtinfo, prio);
+
+		if(earlier_deadline(&deadline, &end)) {
+			t->misses++;
+			bench_hist_add(&t->tardiness, bench_delta_us(&deadline, &end));
+		}
+		t->jobs++;
+
+		/* Skip the releases we overran, like a periodic task would */
+		t->release = deadline;
+		while(earlier_deadline(&t->release, &end))
+			add_ts(&t->release, &t->period, &t->release);
+	}
+
+	/* Don't exit before kthread_stop() is called on us */
+	set_current_state(TASK_INTERRUPTIBLE);
+	while(!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+static void bench_print_hist(struct seq_file *m, const char *name,
+			     struct bench_hist *h)
+{
+	int i;
+
+	seq_printf(m, "\n%s: count %lu", name, h->count);
+	if(!h->count) {
+		seq_printf(m, "\n");
+		return;
+	}
+
+	seq_printf(m, " min %ld avg %lld max %ld overflow %lu\n", h->min,
+		   div64_s64(h->sum, h->count), h->max, h->overflow);
+	for(i = 0; i < BENCH_HIST_BUCKETS; i++) {
+		if(h->bucket[i])
+			seq_printf(m, "  %6d %lu\n", i, h->bucket[i]);
+	}
+}
+
+static int bench_show(struct seq_file *m, void *v)
+{
+	int i;
+	struct bench_thread *t;
+	struct bench_hist *total;
+
+	seq_printf(m, "ChronOS benchmark: scheduler %d, flags %d, prio %d, %d threads\n",
+		   sched, flags, prio, nr_bench);
+
+	for(i = 0; i < nr_bench; i++) {
+		t = bench[i];
+		seq_printf(m, "T:%2d period %llu us, jobs %lu, misses %lu, "
+			   "latency min %ld avg %lld max %ld\n", i,
+			   div_u64(timespec_to_ns(&t->period), NSEC_PER_USEC),
+			   t->jobs, t->misses,
+			   t->release_lat.count ? t->release_lat.min : 0,
+			   t->release_lat.count ? div64_s64(t->release_lat.sum, t->release_lat.count) : 0,
+			   t->release_lat.max);
+		if(t->error)
+			seq_printf(m, "T:%2d stopped, begin_rt_seg failed: %d\n", i, t->error);
+	}
+
+	total = kmalloc(sizeof(*total), GFP_KERNEL);
+	if(!total)
+		return -ENOMEM;
+
+#define H(x) \
+	bench_hist_init(total); \
+	for(i = 0; i < nr_bench; i++) \
+		bench_hist_merge(total, &bench[i]->x); \
+	bench_print_hist(m, #x, total)
+
+	H(release_lat);
+	H(preempt_lat);
+	H(pull_lat);
+	H(tardiness);
+
+#undef H
+
+	kfree(total);
+	return 0;
+}
+
+static int bench_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, bench_show, NULL);
+}
+
+static const struct file_operations bench_fops = {
+	.open		= bench_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int bench_set_scheduler(void)
+{
+	struct rt_sched_local *l_sched = NULL;
+	struct rt_sched_global *g_sched = NULL;
+
+	if(sched & SCHED_GLOBAL_MASK) {
+		g_sched = get_global_scheduler(sched);
+		if(g_sched)
+			l_sched = get_local_scheduler(g_sched->local);
+	} else
+		l_sched = get_local_scheduler(sched);
+
+	if(!l_sched) {
+		printk("chronos_bench: scheduler %d not found!\n", sched);
+		return -EINVAL;
+	}
+
+	bench_global = g_sched != NULL;
+	l_sched->flags = flags;
+
+	return set_scheduler_mask(l_sched, g_sched, &bench_mask, prio);
+}
+
+/* Hand the CPUs back to the default local scheduler */
+static void bench_restore_scheduler(void)
+{
+	struct rt_sched_local *l_sched = get_local_scheduler(SCHED_RT_FIFO);
+
+	if(l_sched)
+		set_scheduler_mask(l_sched, NULL, &bench_mask, 0);
+}
+
+static void bench_stop_threads(void)
+{
+	int i;
+
+	for(i = 0; i < nr_bench; i++) {
+		if(bench[i]->task)
+			kthread_stop(bench[i]->task);
+	}
+}
+
+static void bench_free_threads(void)
+{
+	int i;
+
+	for(i = 0; i < nr_bench; i++)
+		kfree(bench[i]);
+	kfree(bench);
+}
+
+static int bench_start_threads(void)
+{
+	int i, cpu = -1;
+	struct bench_thread *t;
+
+	for(i = 0; i < nr_bench; i++) {
+		t = bench[i];
+		t->task = kthread_create(bench_thread_fn, t, "chronos_bench/%d", i);
+		if(IS_ERR(t->task)) {
+			t->task = NULL;
+			return -ENOMEM;
+		}
+
+		/* Partitioned schedulers get their threads spread over the
+		 * CPUs, global schedulers are free to place them */
+		if(bench_global)
+			set_cpus_allowed_ptr(t->task, &bench_mask);
+		else {
+			cpu = cpumask_next(cpu, &bench_mask);
+			if(cpu >= nr_cpu_ids)
+				cpu = cpumask_first(&bench_mask);
+			kthread_bind(t->task, cpu);
+		}
+	}
+
+	for(i = 0; i < nr_bench; i++)
+		wake_up_process(bench[i]->task);
+
+	return 0;
+}
+
+static int __init bench_init(void)
+{
+	int i, ret = -ENOMEM;
+	struct bench_thread *t;
+
+	if(period_us <= 0 || exec_us <= 0 || loops <= 0 || threads < 0)
+		return -EINVAL;
+
+	if(cpus)
+		bitmap_copy(cpumask_bits(&bench_mask), &cpus, min_t(int, nr_cpu_ids, BITS_PER_LONG));
+	else
+		cpumask_copy(&bench_mask, cpu_online_mask);
+	cpumask_and(&bench_mask, &bench_mask, cpu_online_mask);
+
+	if(cpumask_empty(&bench_mask))
+		return -EINVAL;
+
+	nr_bench = threads ? threads : cpumask_weight(&bench_mask);
+	bench = kzalloc(nr_bench * sizeof(*bench), GFP_KERNEL);
+	if(!bench)
+		return -ENOMEM;
+
+	for(i = 0; i < nr_bench; i++) {
+		t = kzalloc(sizeof(*t), GFP_KERNEL);
+		if(!t)
+			goto out_free;
+
+		bench[i] = t;
+		t->period = ns_to_timespec((s64)(period_us + i * interval_us) * NSEC_PER_USEC);
+		hrtimer_init(&t->timer, CLOCK_REALTIME, HRTIMER_MODE_ABS);
+		t->timer.function = bench_release;
+		t->timer.irqsafe = 1;
+		bench_hist_init(&t->release_lat);
+		bench_hist_init(&t->preempt_lat);
+		bench_hist_init(&t->pull_lat);
+		bench_hist_init(&t->tardiness);
+	}
+
+	ret = bench_set_scheduler();
+	if(ret)
+		goto out_free;
+
+	if(!proc_create("chronos/bench", 0444, NULL, &bench_fops)) {
+		ret = -ENOMEM;
+		goto out_restore;
+	}
+
+	ret = bench_start_threads();
+	if(ret) {
+		bench_stop_threads();
+		remove_proc_entry("chronos/bench", NULL);
+		goto out_restore;
+	}
+
+	return 0;
+
+out_restore:
+	bench_restore_scheduler();
+out_free:
+	bench_free_threads();
+	return ret;
+}
+module_init(bench_init);
+
+static void __exit bench_exit(void)
+{
+	bench_stop_threads();
+	remove_proc_entry("chronos/bench", NULL);
+	bench_free_threads();
+	bench_restore_scheduler();
+}
+module_exit(bench_exit);
+
+MODULE_DESCRIPTION("Latency Benchmark Module for ChronOS");
+MODULE_LICENSE("GPL");
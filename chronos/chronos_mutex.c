@@ -13,6 +13,19 @@
  * We are using a data structure (struct mutex_data, in linux/chronos_types.h)
  * as a mutex. The user creates it through C/C++/Java/etc, and then passes the
  * pointer down in a system call.
+ *
+ * The same structure can be set up as a phase-fair reader-writer lock with
+ * CHRONOS_RWLOCK_INIT. Readers never block each other. A reader that finds a
+ * writer waiting or holding the lock waits for that writer to finish, and then
+ * enters along with every other reader that queued up behind it. Writers go in
+ * FIFO order, and each waits for the readers holding the lock to leave. So a
+ * reader waits out at most one writer, and a writer waits at most one reader
+ * phase for each writer ahead of it.
+ *
+ * Either kind of lock can be shared between processes that map the same
+ * memory, by or'ing CHRONOS_MUTEX_SHARED into every op on it. Shared locks are
+ * kept apart from those of any process and looked up by the futex key of their
+ * value, which is the same in every process mapping it, instead of by id.
  */
 
 #include <asm/current.h>
@@ -20,6 +33,8 @@
 #include <asm/futex.h>
 #include <linux/futex.h>
 #include <linux/linkage.h>
+#include <linux/mm.h>
+#include <linux/rculist.h>
 #include <linux/sched.h>
 #include <linux/syscalls.h>
 #include <linux/time.h>
@@ -46,9 +61,34 @@ struct process_mutex_list {
 	rwlock_t lock;
 };
 
+/* A reader of a reader-writer lock, or a writer waiting for one */
+struct rw_holder {
+	struct list_head list;
+	struct rt_info *r;
+	int admitted;
+};
+
 static LIST_HEAD(chronos_mutex_list);
 static DEFINE_RWLOCK(chronos_mutex_list_lock);
 
+/* Process-shared locks. Their ceilings only apply to each other, but across
+ * all processes. Ceiling waits can't use the futex of a lock another process
+ * set up, so they wait for shared_seq to tick over instead. The list is also
+ * walked by schedulers, under RCU, so heads are removed and freed with RCU.
+ * Any process may create shared locks, so there are at most
+ * SHARED_MUTEXES_MAX, and a lock nothing maps any more is freed when its
+ * last mapper exits, see reap_shared_mutexes(). */
+#define SHARED_MUTEXES_MAX	1024
+
+static struct process_mutex_list shared_mutexes = {
+	.m_list = LIST_HEAD_INIT(shared_mutexes.m_list),
+	.lock = __RW_LOCK_UNLOCKED(shared_mutexes.lock),
+};
+static DECLARE_WAIT_QUEUE_HEAD(shared_ceiling_wait);
+static u32 shared_seq;
+static unsigned long shared_ids;
+static int shared_count;
+
 static struct process_mutex_list * find_by_tgid(pid_t pid)
 {
 	struct list_head *curr;
@@ -77,9 +117,50 @@ struct list_head * get_current_task_mutex_list(pid_t tgid)
 }
 EXPORT_SYMBOL(get_current_task_mutex_list);
 
+struct list_head * get_shared_mutex_list(void)
+{
+	return &shared_mutexes.m_list;
+}
+EXPORT_SYMBOL(get_shared_mutex_list);
+
+static struct process_mutex_list * find_process(int shared)
+{
+	if(shared)
+		return &shared_mutexes;
+
+	return find_by_tgid(current->tgid);
+}
+
+/* Called with shared_mutexes.lock held */
+static struct mutex_head * find_shared(struct mutex_data *m)
+{
+	union futex_key key = FUTEX_KEY_INIT;
+	struct mutex_head *head, *ret = NULL;
+
+	if(get_futex_key(&m->value, 1, &key, VERIFY_WRITE))
+		return NULL;
+
+	list_for_each_entry(head, &shared_mutexes.m_list, list) {
+		if(head->key.both.word == key.both.word &&
+		   head->key.both.ptr == key.both.ptr &&
+		   head->key.both.offset == key.both.offset) {
+			ret = head;
+			break;
+		}
+	}
+
+	put_futex_key(&key);
+	return ret;
+}
+
 static struct mutex_head * find_in_process(struct mutex_data *m, struct process_mutex_list * process)
 {
-	struct mutex_head *head = (struct mutex_head *)((unsigned long)process + m->id);
+	struct mutex_head *head;
+
+	if(process == &shared_mutexes)
+		return find_shared(m);
+
+	head = (struct mutex_head *)((unsigned long)process + m->id);
 
 	if(head->id != m->id)
 		head = NULL;
@@ -110,9 +191,189 @@ static void futex_wake(u32 __user *uaddr)
 	do_futex(uaddr, FUTEX_WAKE, 1, NULL, NULL, 0, 0);
 }
 
-static int init_rt_resource(struct mutex_data __user *mutexreq)
+static void futex_wake_all(u32 __user *uaddr)
 {
-	struct process_mutex_list *process = find_by_tgid(current->tgid);
+	do_futex(uaddr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0, 0);
+}
+
+/* A lock of process was released, called with its lock held */
+static void lock_released(struct process_mutex_list *process)
+{
+	if(process == &shared_mutexes) {
+		shared_seq++;
+		wake_up_all(&shared_ceiling_wait);
+	}
+}
+
+/* Does r hold m, for reading or writing? */
+static int lock_held_by(struct mutex_head *m, struct rt_info *r)
+{
+	struct rw_holder *h;
+
+	if(m->owner_t == r)
+		return 1;
+
+	if(m->rw) {
+		list_for_each_entry(h, &m->readers, list) {
+			if(h->r == r)
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* While only readers hold a reader-writer lock, its ceiling just has to keep
+ * out the writers */
+static struct timespec * lock_ceiling(struct mutex_head *m)
+{
+	if(m->rw && !m->write_held)
+		return &m->wperiod_floor;
+
+	return &m->period_floor;
+}
+
+/* Take the process lock once every lock held by another task has a lower
+ * priority ceiling than r. The lock with id skip is left out. */
+static void ocpp_lock(struct process_mutex_list *process, struct rt_info *r,
+		      unsigned long skip)
+{
+#ifdef OCPP_ON
+	struct mutex_head *curr_mutex;
+	u32 *waiting_on;
+	u32 old_value;
+
+	// Wait until all locked mutexes have a lower priority ceiling.
+	while (1) {
+		write_lock(&process->lock);
+		// We succeed when we don't find anything.
+		waiting_on = NULL;
+		// Iterate through every mutex of the process.
+		list_for_each_entry(curr_mutex, &process->m_list, list) {
+			// If the mutex has an owner and its period floor is higher priority than this task.
+			if (curr_mutex->owner_t && curr_mutex->id != skip &&
+			    !lock_held_by(curr_mutex, r) &&
+			    compare_ts(lock_ceiling(curr_mutex), &r->period)) {
+				// It isn't allowed to lock it.
+				if (process == &shared_mutexes)
+					waiting_on = &shared_seq;
+				else
+					waiting_on = &curr_mutex->mutex->value;
+				old_value = *waiting_on;
+				break;
+			}
+		}
+		if (waiting_on) {
+			write_unlock(&process->lock);
+			if (process == &shared_mutexes)
+				wait_event(shared_ceiling_wait,
+					   ACCESS_ONCE(shared_seq) != old_value);
+			else
+				futex_wait(waiting_on, old_value);
+		} else {
+			break;
+		}
+	}
+#else
+	write_lock(&process->lock);
+#endif
+}
+
+/* Free a shared head once it is off the list */
+static void free_shared_head(struct mutex_head *m)
+{
+	struct rw_holder *h, *n;
+
+	list_for_each_entry_safe(h, n, &m->readers, list)
+		kfree(h);
+	put_futex_key(&m->key);
+	kfree_rcu(m, rcu);
+	cmutexstat_dec(locks);
+}
+
+/* Can no process reach the value of m any more? */
+static int shared_head_unmapped(struct mutex_head *m)
+{
+	switch(m->key.both.offset & (FUT_OFF_INODE | FUT_OFF_MMSHARED)) {
+	case FUT_OFF_INODE:
+		return !mapping_mapped(m->key.shared.inode->i_mapping);
+	case FUT_OFF_MMSHARED:
+		return !atomic_read(&m->key.private.mm->mm_users);
+	}
+
+	return 0;
+}
+
+/* Free the shared locks whose memory is no longer mapped anywhere and which
+ * nobody is queued on. Called when a process has dropped its mm. */
+void reap_shared_mutexes(void)
+{
+	struct process_mutex_list *process = &shared_mutexes;
+	struct mutex_head *m, *found;
+
+	if(list_empty(&process->m_list))
+		return;
+
+	do {
+		found = NULL;
+		write_lock(&process->lock);
+		list_for_each_entry(m, &process->m_list, list) {
+			if(list_empty(&m->rwaiting) && list_empty(&m->wwaiting) &&
+			   shared_head_unmapped(m)) {
+				found = m;
+				list_del_rcu(&m->list);
+				shared_count--;
+				lock_released(process);
+				break;
+			}
+		}
+		write_unlock(&process->lock);
+
+		if(found)
+			free_shared_head(found);
+	} while(found);
+}
+
+static int init_shared_resource(struct mutex_data __user *mutexreq,
+				struct mutex_head *m)
+{
+	struct process_mutex_list *process = &shared_mutexes;
+
+	if(get_futex_key(&mutexreq->value, 1, &m->key, VERIFY_WRITE)) {
+		kfree(m);
+		return -EFAULT;
+	}
+
+	if(shared_count >= SHARED_MUTEXES_MAX)
+		reap_shared_mutexes();
+
+	write_lock(&process->lock);
+	if(shared_count >= SHARED_MUTEXES_MAX) {
+		write_unlock(&process->lock);
+		put_futex_key(&m->key);
+		kfree(m);
+		return -ENOSPC;
+	}
+	if(find_shared(mutexreq)) {
+		write_unlock(&process->lock);
+		put_futex_key(&m->key);
+		kfree(m);
+		return -EBUSY;
+	}
+	m->id = ++shared_ids;
+	list_add_rcu(&m->list, &process->m_list);
+	shared_count++;
+	write_unlock(&process->lock);
+
+	mutexreq->id = m->id;
+	cmutexstat_inc(locks);
+
+	return 0;
+}
+
+static int init_rt_resource(struct mutex_data __user *mutexreq, int rw, int shared)
+{
+	struct process_mutex_list *process = find_process(shared);
 	struct mutex_head *m = kmalloc(sizeof(struct mutex_head), GFP_KERNEL);
 
 	if(!m)
@@ -123,6 +384,15 @@ static int init_rt_resource(struct mutex_data __user *mutexreq)
 	// TODO: This is bad because this isn't the real maximum tv_sec, but its probably fine.
 	m->period_floor.tv_sec = 32767;
 	m->period_floor.tv_nsec = 0;
+	m->rw = rw;
+	m->write_held = 0;
+	m->wperiod_floor = m->period_floor;
+	INIT_LIST_HEAD(&m->readers);
+	INIT_LIST_HEAD(&m->rwaiting);
+	INIT_LIST_HEAD(&m->wwaiting);
+
+	if(shared)
+		return init_shared_resource(mutexreq, m);
 
 	if(!process) {
 		process = kmalloc(sizeof(struct process_mutex_list), GFP_KERNEL);
@@ -153,21 +423,44 @@ static int init_rt_resource(struct mutex_data __user *mutexreq)
 	return 0;
 }
 
-static int destroy_rt_resource(struct mutex_data __user *mutexreq)
+static int destroy_rt_resource(struct mutex_data __user *mutexreq, int shared)
 {
 	int empty;
-	struct process_mutex_list *process = find_by_tgid(current->tgid);
-	struct mutex_head *m = find_in_process(mutexreq, process);
+	struct process_mutex_list *process = find_process(shared);
+	struct mutex_head *m;
+	struct rw_holder *h, *n;
 
-	if(!m || !process)
+	if(!process)
 		return 1;
 
 	// Remove the mutex_head
 	write_lock(&process->lock);
-	list_del(&m->list);
+	m = find_in_process(mutexreq, process);
+	if(!m) {
+		write_unlock(&process->lock);
+		return 1;
+	}
+	if(!list_empty(&m->rwaiting) || !list_empty(&m->wwaiting)) {
+		write_unlock(&process->lock);
+		return -EBUSY;
+	}
+	if(shared) {
+		list_del_rcu(&m->list);
+		shared_count--;
+	} else
+		list_del(&m->list);
 	empty = list_empty(&process->m_list);
+	lock_released(process);
 	write_unlock(&process->lock);
 	futex_wake(&(mutexreq->value));
+
+	if(shared) {
+		free_shared_head(m);
+		return 0;
+	}
+
+	list_for_each_entry_safe(h, n, &m->readers, list)
+		kfree(h);
 	kfree(m);
 
 	if(empty) {
@@ -184,13 +477,10 @@ static int destroy_rt_resource(struct mutex_data __user *mutexreq)
 }
 
 /* Returning 0 means everything was fine, returning > -1 means we got the lock */
-static int request_rt_resource(struct mutex_data __user *mutexreq)
+static int request_rt_resource(struct mutex_data __user *mutexreq, int shared)
 {
 	int c, ret = 0;
 	struct rt_info *r = &current->rtinfo;
-	struct mutex_head *curr_mutex;
-	u32 *waiting_on;
-	u32 old_value;
 	struct process_mutex_list *process;
 	struct mutex_head *m;
 
@@ -200,39 +490,14 @@ static int request_rt_resource(struct mutex_data __user *mutexreq)
 	else if(check_task_abort_nohua(r))
 		return -EOWNERDEAD;
 
-	process = find_by_tgid(current->tgid);
+	process = find_process(shared);
 	if (!process)
 		return -EINVAL;
 
-#ifdef OCPP_ON
-	// Wait until all locked mutexes have a lower priority ceiling.
-	while (1) {
-		write_lock(&process->lock);
-		// We succeed when we don't find anything.
-		waiting_on = NULL;
-		// Iterate through every mutex of the process.
-		list_for_each_entry(curr_mutex, &process->m_list, list) {
-			// If the mutex has an owner and its period floor is higher priority than this task.
-			if (curr_mutex->owner_t && compare_ts(&curr_mutex->period_floor, &r->period)) {
-				// It isn't allowed to lock it.
-				waiting_on = &curr_mutex->mutex->value;
-				old_value = *waiting_on;
-				break;
-			}
-		}
-		if (waiting_on) {
-			write_unlock(&process->lock);
-			futex_wait(waiting_on, old_value);
-		} else {
-			break;
-		}
-	}
-#else
-	write_lock(&process->lock);
-#endif
+	ocpp_lock(process, r, 0);
 
 	m = find_in_process(mutexreq, process);
-	if(!m) {
+	if(!m || m->rw) {
 		write_unlock(&process->lock);
 		return -EINVAL;
 	}
@@ -273,9 +538,9 @@ static int request_rt_resource(struct mutex_data __user *mutexreq)
 	return ret;
 }
 
-static int release_rt_resource(struct mutex_data __user *mutexreq)
+static int release_rt_resource(struct mutex_data __user *mutexreq, int shared)
 {
-	struct process_mutex_list *process = find_by_tgid(current->tgid);
+	struct process_mutex_list *process = find_process(shared);
 	struct mutex_head *m;
 	if (!process)
 		return -EINVAL;
@@ -283,7 +548,7 @@ static int release_rt_resource(struct mutex_data __user *mutexreq)
 	write_lock(&process->lock);
 
 	m = find_in_process(mutexreq, process);
-	if(!m) {
+	if(!m || m->rw) {
 		write_unlock(&process->lock);
 		return -EINVAL;
 	}
@@ -295,6 +560,7 @@ static int release_rt_resource(struct mutex_data __user *mutexreq)
 
 	mutexreq->owner = 0;
 	m->owner_t = NULL;
+	lock_released(process);
 
 	if(cmpxchg(&(mutexreq->value), 1, 0) == 2) {
 		mutexreq->value = 0;
@@ -309,24 +575,275 @@ static int release_rt_resource(struct mutex_data __user *mutexreq)
 
 	return 0;
 }
+
+static int writer_present(struct mutex_head *m)
+{
+	return m->write_held || !list_empty(&m->wwaiting);
+}
+
+static void admit_reader(struct mutex_head *m, struct rw_holder *h)
+{
+	h->admitted = 1;
+	list_add_tail(&h->list, &m->readers);
+	if(!m->owner_t)
+		m->owner_t = h->r;
+}
+
+/* The end of a writer phase: every reader that queued up behind it enters */
+static void end_write_phase(struct mutex_head *m)
+{
+	struct rw_holder *h, *n;
+
+	list_for_each_entry_safe(h, n, &m->rwaiting, list) {
+		list_del(&h->list);
+		admit_reader(m, h);
+	}
+}
+
+static int write_turn(struct mutex_head *m, struct rw_holder *w)
+{
+	return !m->write_held && list_empty(&m->readers) &&
+		m->wwaiting.next == &w->list;
+}
+
+static void rw_floor(struct mutex_head *m, struct rt_info *r, int write)
+{
+	if(compare_ts(&r->period, &m->period_floor))
+		m->period_floor = r->period;
+	if(write && compare_ts(&r->period, &m->wperiod_floor))
+		m->wperiod_floor = r->period;
+}
+
+/* Tell the scheduler we are blocked on m, so that PI follows us to its owner.
+ * Returns 0 if our request was cancelled. */
+static int rw_block(struct mutex_head *m, struct rt_info *r)
+{
+	r->requested_resource = m;
+	force_sched_event(current);
+	schedule();
+
+	return r->requested_resource == m;
+}
+
+/* Sleep until the lock changes state, with the process lock held around it */
+static void rw_wait(struct process_mutex_list *process,
+		    struct mutex_data __user *mutexreq)
+{
+	u32 old_value = mutexreq->value;
+
+	write_unlock(&process->lock);
+	futex_wait(&(mutexreq->value), old_value);
+	write_lock(&process->lock);
+}
+
+/* Drop the process lock and let everyone waiting on the lock look again */
+static void rw_wake(struct process_mutex_list *process,
+		    struct mutex_data __user *mutexreq)
+{
+	mutexreq->value++;
+	write_unlock(&process->lock);
+	futex_wake_all(&(mutexreq->value));
+}
+
+static int request_rt_read(struct mutex_data __user *mutexreq, int shared)
+{
+	int ret = 0;
+	struct rt_info *r = &current->rtinfo;
+	struct process_mutex_list *process;
+	struct mutex_head *m;
+	struct rw_holder *h;
+
+	if(check_task_abort_nohua(r))
+		return -EOWNERDEAD;
+
+	process = find_process(shared);
+	if(!process)
+		return -EINVAL;
+
+	h = kmalloc(sizeof(struct rw_holder), GFP_KERNEL);
+	if(!h)
+		return -ENOMEM;
+
+	h->r = r;
+	h->admitted = 0;
+
+	/* Other readers of this lock never hold us back */
+	ocpp_lock(process, r, mutexreq->id);
+
+	m = find_in_process(mutexreq, process);
+	if(!m || !m->rw) {
+		write_unlock(&process->lock);
+		kfree(h);
+		return -EINVAL;
+	}
+
+	if(!writer_present(m)) {
+		admit_reader(m, h);
+		cmutexstat_inc(locking_success);
+	} else {
+		list_add_tail(&h->list, &m->rwaiting);
+		if(!rw_block(m, r)) {
+			list_del(&h->list);
+			write_unlock(&process->lock);
+			kfree(h);
+			return -EOWNERDEAD;
+		}
+
+		while(!h->admitted)
+			rw_wait(process, mutexreq);
+
+		ret = 1;
+		cmutexstat_inc(locking_failure);
+	}
+
+	rw_floor(m, r, 0);
+	r->requested_resource = NULL;
+
+	write_unlock(&process->lock);
+
+	return ret;
+}
+
+static int request_rt_write(struct mutex_data __user *mutexreq, int shared)
+{
+	int ret = 0;
+	struct rt_info *r = &current->rtinfo;
+	struct process_mutex_list *process;
+	struct mutex_head *m;
+	struct rw_holder w;
+
+	if(mutexreq->owner == current->pid)
+		return 0;
+	else if(check_task_abort_nohua(r))
+		return -EOWNERDEAD;
+
+	process = find_process(shared);
+	if(!process)
+		return -EINVAL;
+
+	ocpp_lock(process, r, 0);
+
+	m = find_in_process(mutexreq, process);
+	if(!m || !m->rw) {
+		write_unlock(&process->lock);
+		return -EINVAL;
+	}
+
+	w.r = r;
+	list_add_tail(&w.list, &m->wwaiting);
+
+	if(!write_turn(m, &w)) {
+		if(!rw_block(m, r)) {
+			list_del(&w.list);
+			if(!writer_present(m))
+				end_write_phase(m);
+			rw_wake(process, mutexreq);
+			return -EOWNERDEAD;
+		}
+
+		while(!write_turn(m, &w))
+			rw_wait(process, mutexreq);
+
+		ret = 1;
+		cmutexstat_inc(locking_failure);
+	} else
+		cmutexstat_inc(locking_success);
+
+	list_del(&w.list);
+	m->write_held = 1;
+	m->owner_t = r;
+	mutexreq->owner = current->pid;
+	rw_floor(m, r, 1);
+	r->requested_resource = NULL;
+
+	write_unlock(&process->lock);
+
+	return ret;
+}
+
+static int release_rt_rwlock(struct mutex_data __user *mutexreq, int shared)
+{
+	struct rt_info *r = &current->rtinfo;
+	struct process_mutex_list *process = find_process(shared);
+	struct mutex_head *m;
+	struct rw_holder *h, *found = NULL;
+
+	if(!process)
+		return -EINVAL;
+
+	write_lock(&process->lock);
+
+	m = find_in_process(mutexreq, process);
+	if(!m || !m->rw) {
+		write_unlock(&process->lock);
+		return -EINVAL;
+	}
+
+	if(m->write_held && mutexreq->owner == current->pid) {
+		mutexreq->owner = 0;
+		m->write_held = 0;
+		m->owner_t = NULL;
+		end_write_phase(m);
+	} else {
+		list_for_each_entry(h, &m->readers, list) {
+			if(h->r == r) {
+				found = h;
+				break;
+			}
+		}
+
+		if(!found) {
+			write_unlock(&process->lock);
+			return -EACCES;
+		}
+
+		list_del(&found->list);
+		kfree(found);
+
+		if(m->owner_t == r)
+			m->owner_t = list_empty(&m->readers) ? NULL :
+				list_first_entry(&m->readers, struct rw_holder, list)->r;
+	}
+
+	lock_released(process);
+	rw_wake(process, mutexreq);
+
+	force_sched_event(current);
+	schedule();
+
+	return 0;
+}
 #endif
 
 SYSCALL_DEFINE2(do_chronos_mutex, struct mutex_data __user, *mutexreq, int, op)
 {
+#ifdef CONFIG_CHRONOS
+	int shared = op & CHRONOS_MUTEX_SHARED;
+#endif
+
 	/* We have to check this every time, so just do it here */
 	if(!mutexreq || !access_ok(VERIFY_WRITE, mutexreq, sizeof(*mutexreq)))
 		return -EFAULT;
 
-	switch(op) {
+	switch(op & ~CHRONOS_MUTEX_SHARED) {
 #ifdef CONFIG_CHRONOS
 		case CHRONOS_MUTEX_REQUEST:
-			return request_rt_resource(mutexreq);
+			return request_rt_resource(mutexreq, shared);
 		case CHRONOS_MUTEX_RELEASE:
-			return release_rt_resource(mutexreq);
+			return release_rt_resource(mutexreq, shared);
 		case CHRONOS_MUTEX_INIT:
-			return init_rt_resource(mutexreq);
+			return init_rt_resource(mutexreq, 0, shared);
 		case CHRONOS_MUTEX_DESTROY:
-			return destroy_rt_resource(mutexreq);
+		case CHRONOS_RWLOCK_DESTROY:
+			return destroy_rt_resource(mutexreq, shared);
+		case CHRONOS_RWLOCK_RDLOCK:
+			return request_rt_read(mutexreq, shared);
+		case CHRONOS_RWLOCK_WRLOCK:
+			return request_rt_write(mutexreq, shared);
+		case CHRONOS_RWLOCK_UNLOCK:
+			return release_rt_rwlock(mutexreq, shared);
+		case CHRONOS_RWLOCK_INIT:
+			return init_rt_resource(mutexreq, 1, shared);
 #endif
 		default:
 			return -EINVAL;
@@ -11,12 +11,18 @@
 #include <asm/current.h>
 #include <asm/uaccess.h>
 #include <linux/cpumask.h>
+#include <linux/interrupt.h>
 #include <linux/linkage.h>
 #include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/rcupdate.h>
 #include <linux/sched.h>
 #include <linux/syscalls.h>
 #include <linux/time.h>
+#include <linux/vmalloc.h>
 #include <linux/chronos_sched.h>
+#include <linux/chronos_util.h>
 
 #ifdef CONFIG_CHRONOS
 
@@ -28,30 +34,59 @@ unsigned long set_ts_from_user(struct timespec *dst, struct timespec __user *src
 	return 0;
 }
 
-/* Begin a real-time segment for a given thread
+/* Begin a real-time segment for a given thread from kernel-side parameters
  * If we want to end one segment and immediately begin a new segment, just make
  * a single begin call, since it will erase all the old data. The only problem
  * right now is that it won't be properly accounted in the sched_stats.
  */
-unsigned long begin_rt_seg(struct rt_data __user *data, struct task_struct *p,
-			   struct rt_info *task)
+int _begin_rt_seg(struct task_struct *p, struct rt_info *task,
+		  struct timespec *deadline, struct timespec *period,
+		  unsigned long exec_time, unsigned int max_util, int prio)
 {
-	int ret = 0;
 	struct sched_param param;
+	struct timespec now;
+	ktime_t expires;
+	int ret;
+
+	/* Budget the segment by what the task has been seen to need, or by its
+	 * whole period if there is nothing to go on yet */
+	if(exec_time == EXEC_TIME_OBSERVED) {
+		exec_time = wcet_quantile(task, WCET_OBSERVED_PERMILLE);
+		if(!exec_time)
+			exec_time = timespec_to_long(period);
+	}
+
+	/* Refuse the segment if its cgroup has no bandwidth left for it */
+	ret = chronos_cgroup_begin(p, task, exec_time, period, &prio);
+	if(ret)
+		return ret;
 
 	/* Kill all flags, except whether it is has an abort handler or not  */
 	task_and_flag(task, HUA);
 
+	/* A deadline handed down by a message the task received runs this
+	 * segment if it is the more urgent one, and has not passed already */
+	getnstimeofday(&now);
+	if(!is_zero_ts(&task->msg_deadline) &&
+	   earlier_deadline(&now, &task->msg_deadline) &&
+	   (is_zero_ts(deadline) || earlier_deadline(&task->msg_deadline, deadline)))
+		deadline = &task->msg_deadline;
+
 	/* Initialize the deadline and period */
-	ret |= set_ts_from_user(&task->deadline, data->deadline);
-	ret |= set_ts_from_user(&task->period, data->period);
+	task->deadline = *deadline;
+	task->period = *period;
+	zero_ts(&task->msg_deadline);
 
 	/* Initialize the execution time, schedule, utility, and IVD */
-	task->exec_time = data->exec_time;
-	task->max_util = data->max_util;
-	task->local_ivd = data->max_util == 0 ? LONG_MAX : data->exec_time/data->max_util;
+	task->exec_time = exec_time;
+	task->max_util = max_util;
+	task->local_ivd = max_util == 0 ? LONG_MAX : exec_time/max_util;
 	task->global_ivd = task->local_ivd;
 	task->seg_start_us = jiffies_to_usecs(p->utime + p->stime);
+	task->seg_start_runtime = task_sched_runtime(p);
+	task->migration_charged = 0;
+	task->dp_slice = 0;
+	task->critinfo.exec_time[CRIT_LO] = exec_time;
 
 	/* Initialize things that shouldn't have a value yet */
 	task->dep = NULL;
@@ -63,22 +98,64 @@ unsigned long begin_rt_seg(struct rt_data __user *data, struct task_struct *p,
 	/* Make sure the task isn't set to be aborting */
 	clear_task_aborting(p->pid);
 
-	param.sched_priority = data->prio;
+	param.sched_priority = prio;
 	sched_setscheduler_nocheck(p, SCHED_CHRONOS, &param);
+
+	/* Fail the segment as soon as it misses its deadline or, if it has an
+	 * abort handler, as soon as the handler would not fit before it. This
+	 * is armed once the task is SCHED_CHRONOS, so that a deadline that has
+	 * already passed still fails it. */
+	if(!is_zero_ts(&task->deadline)) {
+		expires = timespec_to_ktime(task->deadline);
+		if(task_check_flag(task, HUA))
+			expires = ktime_sub_us(expires, task->abortinfo.exec_time);
+		hrtimer_start(&task->deadline_timer, expires, HRTIMER_MODE_ABS);
+	}
 	force_sched_event(p);
 	schedule();
-	return ret;
+
+	return 0;
 }
+EXPORT_SYMBOL(_begin_rt_seg);
 
-/* End a real-time segment for a given thread */
-unsigned long end_rt_seg(struct rt_data __user *data, struct task_struct *p,
-			 struct rt_info *task)
+/* Begin a real-time segment for a given thread */
+unsigned long begin_rt_seg(struct rt_data __user *data, struct task_struct *p,
+			   struct rt_info *task)
+{
+	int ret = 0;
+	struct timespec deadline, period;
+
+	ret |= set_ts_from_user(&deadline, data->deadline);
+	ret |= set_ts_from_user(&period, data->period);
+
+	if(ret)
+		return ret;
+
+	/* The limit may have been lowered since the budget was registered */
+	if(task->np_budget > sysctl_chronos_np_budget_max)
+		return -EINVAL;
+
+	return _begin_rt_seg(p, task, &deadline, &period, data->exec_time,
+			     data->max_util, data->prio);
+}
+
+/* End a real-time segment for a given thread, dropping it back to SCHED_FIFO
+ * at prio, or to SCHED_NORMAL if prio is 0.
+ */
+void _end_rt_seg(struct task_struct *p, struct rt_info *task, int prio)
 {
 	struct sched_param param;
 	int policy, oldprio;
 
-	if(data->prio) {
-		param.sched_priority = data->prio;
+	hrtimer_cancel(&task->deadline_timer);
+	chronos_cgroup_end(task);
+	irq_drop_chronos_waiter(p);
+
+	if(p->policy == SCHED_CHRONOS)
+		wcet_record(task, div_u64(seg_runtime(task), NSEC_PER_USEC));
+
+	if(prio) {
+		param.sched_priority = prio;
 		policy = SCHED_FIFO;
 	} else {
 		param.sched_priority = DEFAULT_PRIO;
@@ -96,8 +173,18 @@ unsigned long end_rt_seg(struct rt_data __user *data, struct task_struct *p,
 	task->abortinfo.deadline.tv_nsec = 0;
 	task->abortinfo.exec_time = 0;
 	task->abortinfo.max_util = 0;
+	memset(&task->critinfo, 0, sizeof(struct crit_info));
+	task->preempt_threshold.tv_sec = 0;
+	task->preempt_threshold.tv_nsec = 0;
 	task_init_flags(task);
+}
+EXPORT_SYMBOL(_end_rt_seg);
 
+/* End a real-time segment for a given thread */
+unsigned long end_rt_seg(struct rt_data __user *data, struct task_struct *p,
+			 struct rt_info *task)
+{
+	_end_rt_seg(p, task, data->prio);
 	return 0;
 }
 
@@ -113,21 +200,139 @@ unsigned long add_abort_handler(struct rt_data __user *data, struct task_struct
 	task_set_flag(task, HUA);
 	return set_ts_from_user(&task->abortinfo.deadline, data->deadline);
 }
-#endif
 
-SYSCALL_DEFINE2(do_rt_seg, int, op, struct rt_data __user, *data)
+/* Set the criticality of a task's next segment
+ * data->prio is the criticality level and data->exec_time the WCET at that
+ * level. Make one call for each level above CRIT_LO before the segment
+ * begins; the CRIT_LO WCET is the exec_time given to begin_rt_seg.
+ */
+unsigned long set_crit_level(struct rt_data __user *data, struct task_struct *p,
+			     struct rt_info *task)
 {
-	struct task_struct *p;
+	int level = data->prio;
 
-	/* We have to check this every time, so just do it here */
-	if(!data || !access_ok(VERIFY_READ, data, sizeof(*data)))
+	if(level <= CRIT_LO || level >= CRIT_LEVELS)
+		return -EINVAL;
+
+	task->critinfo.exec_time[level] = data->exec_time;
+	if(level > task->critinfo.level)
+		task->critinfo.level = level;
+
+	return 0;
+}
+
+/* Set the preemption threshold of a task's next segment
+ * data->period points at the threshold, given as a period: once the segment
+ * has started it is only preempted by tasks with a shorter period than this.
+ */
+unsigned long set_preempt_threshold(struct rt_data __user *data, struct task_struct *p,
+				    struct rt_info *task)
+{
+	return set_ts_from_user(&task->preempt_threshold, data->period);
+}
+
+/* Make a task part of a gang, or take it out of one
+ * data->exec_time is the gang id, shared by all of its threads and 0 for no
+ * gang. Threads of a gang should begin their segments with the same deadline.
+ */
+unsigned long set_gang(struct rt_data __user *data, struct task_struct *p,
+		       struct rt_info *task)
+{
+	task->gang_id = data->exec_time;
+	return 0;
+}
+
+/* Let the threads of an interrupt inherit the deadline of a task
+ * data->prio is the irq the task waits on, and data->exec_time is 1 to bind
+ * the task to it and 0 to unbind it again. The task must be SCHED_CHRONOS,
+ * i.e. inside a segment, to be bound.
+ */
+unsigned long set_irq_waiter(struct rt_data __user *data, struct task_struct *p,
+			     struct rt_info *task)
+{
+	if(data->prio < 0)
+		return -EINVAL;
+
+	return irq_set_chronos_waiter(data->prio, data->exec_time ? p : NULL);
+}
+
+/* Read back a quantile of a task's observed segment execution times
+ * data->prio is the quantile in thousandths, and the time in us is written
+ * to data->exec_time.
+ */
+unsigned long get_wcet(struct rt_data __user *data, struct task_struct *p,
+		       struct rt_info *task)
+{
+	if(data->prio < 0)
+		return -EINVAL;
+
+	return put_user(wcet_quantile(task, data->prio), &data->exec_time);
+}
+
+/* Drop a task's limited preemption control word */
+void release_np_ctrl(struct rt_info *task)
+{
+	struct np_ctrl *ctrl = task->np_ctrl;
+
+	if(!ctrl)
+		return;
+
+	/* Other CPUs only look at it with their runqueue locked */
+	task->np_ctrl = NULL;
+	synchronize_sched();
+
+	vunmap((void *)((unsigned long)ctrl & PAGE_MASK));
+	set_page_dirty_lock(task->np_page);
+	put_page(task->np_page);
+	task->np_page = NULL;
+	task->np_budget = 0;
+}
+
+/* Register the limited preemption control word of the calling thread
+ * For this call data->deadline points at a struct np_ctrl rather than a
+ * timespec, and data->exec_time is the longest, in us, that a preemption may
+ * be held back while the thread is in a non-preemptive region, at most
+ * sysctl_chronos_np_budget_max. A NULL pointer unregisters it.
+ */
+unsigned long set_np_ctrl(struct rt_data __user *data, struct task_struct *p,
+			  struct rt_info *task)
+{
+	unsigned long addr = (unsigned long)data->deadline;
+	struct page *page;
+	void *base;
+
+	if(p != current)
+		return -EINVAL;
+
+	release_np_ctrl(task);
+	if(!addr)
+		return 0;
+
+	if(data->exec_time > sysctl_chronos_np_budget_max)
+		return -EINVAL;
+
+	if(addr & (sizeof(u32) - 1) ||
+	   (addr & ~PAGE_MASK) + sizeof(struct np_ctrl) > PAGE_SIZE)
+		return -EINVAL;
+
+	if(get_user_pages_fast(addr, 1, 1, &page) != 1)
 		return -EFAULT;
 
-	if(!data->tid)
-		p = current;
-	else
-		p = find_task_by_vpid(data->tid);
+	base = vmap(&page, 1, VM_MAP, PAGE_KERNEL);
+	if(!base) {
+		put_page(page);
+		return -ENOMEM;
+	}
+
+	task->np_page = page;
+	task->np_budget = data->exec_time;
+	task->np_ctrl = base + (addr & ~PAGE_MASK);
+	return 0;
+}
+#endif
 
+static long do_rt_seg_op(int op, struct rt_data __user *data, struct task_struct *p)
+{
 	switch(op) {
 #ifdef CONFIG_CHRONOS
 		case RT_SEG_BEGIN:
@@ -136,9 +341,49 @@ SYSCALL_DEFINE2(do_rt_seg, int, op, struct rt_data __user, *data)
 			return end_rt_seg(data, p, &p->rtinfo);
 		case RT_SEG_ADD_ABORT:
 			return add_abort_handler(data, p, &p->rtinfo);
+		case RT_SEG_SET_CRIT:
+			return set_crit_level(data, p, &p->rtinfo);
+		case RT_SEG_SET_NP:
+			return set_np_ctrl(data, p, &p->rtinfo);
+		case RT_SEG_SET_THRESHOLD:
+			return set_preempt_threshold(data, p, &p->rtinfo);
+		case RT_SEG_SET_GANG:
+			return set_gang(data, p, &p->rtinfo);
+		case RT_SEG_SET_IRQ:
+			return set_irq_waiter(data, p, &p->rtinfo);
+		case RT_SEG_GET_WCET:
+			return get_wcet(data, p, &p->rtinfo);
 #endif
 		default:
 			return -EINVAL;
 	}
 }
 
+SYSCALL_DEFINE2(do_rt_seg, int, op, struct rt_data __user, *data)
+{
+	struct task_struct *p;
+	long ret;
+
+	/* We have to check this every time, so just do it here */
+	if(!data || !access_ok(VERIFY_READ, data, sizeof(*data)))
+		return -EFAULT;
+
+	/* Hold on to another thread while we work on it, as it may exit */
+	rcu_read_lock();
+	if(!data->tid)
+		p = current;
+	else
+		p = find_task_by_vpid(data->tid);
+	if(p)
+		get_task_struct(p);
+	rcu_read_unlock();
+
+	if(!p)
+		return -ESRCH;
+
+	ret = do_rt_seg_op(op, data, p);
+	put_task_struct(p);
+
+	return ret;
+}
+
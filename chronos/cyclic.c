@@ -0,0 +1,370 @@
+/* chronos/cyclic.c
+ *
+ * Table-Driven Cyclic Executive Scheduler Module for ChronOS
+ *
+ * Dispatching follows a table computed offline, which gives for each CPU the
+ * offsets into the hyperperiod at which a thread is to start running. The
+ * table is loaded through /proc/chronos/cyclic:
+ *
+ *	hyperperiod <us>		starts a new, empty table
+ *	<cpu> <offset us> <tid>		adds a slot, tid 0 leaves the CPU idle
+ *	start				dispatches from the next hyperperiod
+ *
+ * Slots must be given in increasing order of offset for each CPU, and
+ * hyperperiods are aligned to CLOCK_REALTIME. Each CPU has a pinned timer
+ * which steps to the next slot at every boundary and reschedules, and the
+ * schedulers just hand back the thread of the current slot, so nothing is
+ * decided at run time. The CYCLIC local scheduler dispatches threads on their
+ * own CPU; all threads in the table must share one ChronOS priority, and in
+ * idle slots lower priority tasks run. GCYCLIC
+ * does the same over a global domain, so a thread may have slots on more than
+ * one CPU.
+ *
+ * Copyright (C) 2009-2012 Virginia Tech Real Time Systems Lab
+ */
+
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/pid.h>
+#include <linux/proc_fs.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/chronos_types.h>
+#include <linux/chronos_sched.h>
+#include <linux/chronos_util.h>
+#include <linux/list.h>
+
+#define CYCLIC_MAX_SLOTS	64
+
+struct cyclic_slot {
+	u64 offset;			/* ns into the hyperperiod */
+	struct task_struct *task;	/* NULL to idle */
+};
+
+struct cyclic_cpu {
+	struct hrtimer timer;
+	int cpu;
+	int nr_slots;
+	/* The slot the timer is set for, and the hyperperiod it is in */
+	int next;
+	u64 epoch;
+	/* The task of the current slot */
+	struct rt_info *dispatch;
+	struct cyclic_slot slots[CYCLIC_MAX_SLOTS];
+};
+
+static DEFINE_PER_CPU(struct cyclic_cpu, cyclic_cpus);
+static DEFINE_MUTEX(cyclic_lock);
+static u64 hyperperiod;
+static int running;
+
+static enum hrtimer_restart cyclic_tick(struct hrtimer *timer)
+{
+	struct cyclic_cpu *c = container_of(timer, struct cyclic_cpu, timer);
+	struct task_struct *p = c->slots[c->next].task;
+
+	c->dispatch = p ? &p->rtinfo : NULL;
+
+	if(++c->next == c->nr_slots) {
+		c->next = 0;
+		c->epoch += hyperperiod;
+	}
+
+	hrtimer_set_expires(timer, ns_to_ktime(c->epoch + c->slots[c->next].offset));
+	chronos_resched_cpu(c->cpu);
+
+	return HRTIMER_RESTART;
+}
+
+/* Runs on the CPU itself, so that the timer is pinned there */
+static void cyclic_start_cpu(void *data)
+{
+	struct cyclic_cpu *c = data;
+
+	hrtimer_start(&c->timer, ns_to_ktime(c->epoch + c->slots[0].offset),
+		      HRTIMER_MODE_ABS_PINNED);
+}
+
+static void cyclic_start(void)
+{
+	int cpu;
+	u64 epoch;
+	struct cyclic_cpu *c;
+	struct timespec now;
+
+	getnstimeofday(&now);
+	epoch = (div64_u64(timespec_to_ns(&now), hyperperiod) + 1) * hyperperiod;
+
+	for_each_online_cpu(cpu) {
+		c = &per_cpu(cyclic_cpus, cpu);
+		if(!c->nr_slots)
+			continue;
+
+		c->next = 0;
+		c->epoch = epoch;
+		smp_call_function_single(cpu, cyclic_start_cpu, c, 1);
+	}
+
+	running = 1;
+}
+
+/* Stop dispatching and throw the table away */
+static void cyclic_clear(void)
+{
+	int cpu, i;
+	struct cyclic_cpu *c;
+
+	for_each_possible_cpu(cpu) {
+		c = &per_cpu(cyclic_cpus, cpu);
+		hrtimer_cancel(&c->timer);
+		c->dispatch = NULL;
+	}
+
+	/* Nobody can still be looking at a task once the schedulers that
+	 * might have been have all finished */
+	synchronize_sched();
+
+	for_each_possible_cpu(cpu) {
+		c = &per_cpu(cyclic_cpus, cpu);
+		for(i = 0; i < c->nr_slots; i++) {
+			if(c->slots[i].task)
+				put_task_struct(c->slots[i].task);
+		}
+		c->nr_slots = 0;
+	}
+
+	running = 0;
+}
+
+static int cyclic_add_slot(int cpu, unsigned long offset_us, pid_t tid)
+{
+	struct cyclic_cpu *c;
+	struct cyclic_slot *s;
+	struct pid *pid;
+	u64 offset = (u64)offset_us * NSEC_PER_USEC;
+
+	if(running)
+		return -EBUSY;
+
+	if(!hyperperiod || offset >= hyperperiod || cpu < 0 || cpu >= nr_cpu_ids ||
+	   !cpu_online(cpu))
+		return -EINVAL;
+
+	c = &per_cpu(cyclic_cpus, cpu);
+	if(c->nr_slots == CYCLIC_MAX_SLOTS)
+		return -ENOSPC;
+
+	if(c->nr_slots && offset <= c->slots[c->nr_slots - 1].offset)
+		return -EINVAL;
+
+	s = &c->slots[c->nr_slots];
+	s->offset = offset;
+	s->task = NULL;
+
+	if(tid) {
+		pid = find_get_pid(tid);
+		s->task = get_pid_task(pid, PIDTYPE_PID);
+		put_pid(pid);
+		if(!s->task)
+			return -ESRCH;
+	}
+
+	c->nr_slots++;
+	return 0;
+}
+
+static int cyclic_parse(char *line)
+{
+	int cpu;
+	unsigned long us;
+	pid_t tid;
+
+	if(!*line)
+		return 0;
+
+	if(sscanf(line, "hyperperiod %lu", &us) == 1) {
+		cyclic_clear();
+		hyperperiod = (u64)us * NSEC_PER_USEC;
+		return 0;
+	}
+
+	if(!strcmp(line, "start")) {
+		if(running || !hyperperiod)
+			return -EINVAL;
+		cyclic_start();
+		return 0;
+	}
+
+	if(sscanf(line, "%d %lu %d", &cpu, &us, &tid) == 3)
+		return cyclic_add_slot(cpu, us, tid);
+
+	return -EINVAL;
+}
+
+static ssize_t cyclic_write(struct file *filp, const char __user *ubuf,
+			    size_t count, loff_t *ppos)
+{
+	char *buf, *line, *pos;
+	int ret = 0;
+
+	if(count >= PAGE_SIZE)
+		return -EINVAL;
+
+	buf = kmalloc(count + 1, GFP_KERNEL);
+	if(!buf)
+		return -ENOMEM;
+
+	if(copy_from_user(buf, ubuf, count)) {
+		kfree(buf);
+		return -EFAULT;
+	}
+	buf[count] = '\0';
+
+	mutex_lock(&cyclic_lock);
+	pos = buf;
+	while(!ret && (line = strsep(&pos, "\n")) != NULL)
+		ret = cyclic_parse(strim(line));
+	mutex_unlock(&cyclic_lock);
+
+	kfree(buf);
+	return ret ? ret : count;
+}
+
+static int cyclic_show(struct seq_file *m, void *v)
+{
+	int cpu, i;
+	struct cyclic_cpu *c;
+	struct cyclic_slot *s;
+
+	mutex_lock(&cyclic_lock);
+	seq_printf(m, "hyperperiod %llu\n", div_u64(hyperperiod, NSEC_PER_USEC));
+
+	for_each_possible_cpu(cpu) {
+		c = &per_cpu(cyclic_cpus, cpu);
+		for(i = 0; i < c->nr_slots; i++) {
+			s = &c->slots[i];
+			seq_printf(m, "%d %llu %d\n", cpu, div_u64(s->offset, NSEC_PER_USEC),
+				   s->task ? s->task->pid : 0);
+		}
+	}
+
+	seq_printf(m, "%s\n", running ? "running" : "stopped");
+	mutex_unlock(&cyclic_lock);
+
+	return 0;
+}
+
+static int cyclic_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, cyclic_show, NULL);
+}
+
+static const struct file_operations cyclic_fops = {
+	.owner		= THIS_MODULE,
+	.open		= cyclic_open,
+	.read		= seq_read,
+	.write		= cyclic_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+struct rt_info* sched_cyclic(struct list_head *head, int flags)
+{
+	int cpu = smp_processor_id();
+	struct rt_info *r = per_cpu(cyclic_cpus, cpu).dispatch;
+
+	/* The task may be queued, but on another CPU if it was moved there */
+	if(!r || list_empty(&r->task_list[LOCAL_LIST]) ||
+	   task_cpu(task_of_rtinfo(r)) != cpu ||
+	   task_of_rtinfo(r)->prio != task_of_rtinfo(local_task(head->next))->prio)
+		return NULL;
+
+	return r;
+}
+
+struct rt_info * sched_gcyclic(struct list_head *head, struct global_sched_domain *g)
+{
+	int cpu = raw_smp_processor_id();
+	struct rt_info *r = per_cpu(cyclic_cpus, cpu).dispatch;
+
+	if(!r || !in_global_list(r) || !task_pullable(r, cpu))
+		return NULL;
+
+	return r;
+}
+
+struct rt_sched_local cyclic = {
+	.base.name = "CYCLIC",
+	.base.id = SCHED_RT_CYCLIC,
+	.flags = 0,
+	.schedule = sched_cyclic,
+	.base.sort_key = SORT_KEY_NONE,
+	.base.list = LIST_HEAD_INIT(cyclic.base.list)
+};
+
+struct rt_sched_global gcyclic = {
+	.base.name = "GCYCLIC",
+	.base.id = SCHED_RT_GCYCLIC,
+	.schedule = sched_gcyclic,
+	.preschedule = presched_stw_generic,
+	.arch = &rt_sched_arch_timed,
+	.local = SCHED_RT_FIFO,
+	.base.sort_key = SORT_KEY_NONE,
+	.base.list = LIST_HEAD_INIT(gcyclic.base.list)
+};
+
+static int __init cyclic_init(void)
+{
+	int cpu, ret;
+	struct cyclic_cpu *c;
+
+	for_each_possible_cpu(cpu) {
+		c = &per_cpu(cyclic_cpus, cpu);
+		hrtimer_init(&c->timer, CLOCK_REALTIME, HRTIMER_MODE_ABS);
+		c->timer.function = cyclic_tick;
+		c->timer.irqsafe = 1;
+		c->cpu = cpu;
+	}
+
+	if(!proc_create("chronos/cyclic", 0644, NULL, &cyclic_fops))
+		return -ENOMEM;
+
+	ret = add_local_scheduler(&cyclic);
+	if(ret)
+		goto out_proc;
+
+	ret = add_global_scheduler(&gcyclic);
+	if(ret)
+		goto out_local;
+
+	return 0;
+
+out_local:
+	remove_local_scheduler(&cyclic);
+out_proc:
+	remove_proc_entry("chronos/cyclic", NULL);
+	return ret;
+}
+module_init(cyclic_init);
+
+static void __exit cyclic_exit(void)
+{
+	remove_global_scheduler(&gcyclic);
+	remove_local_scheduler(&cyclic);
+	remove_proc_entry("chronos/cyclic", NULL);
+
+	mutex_lock(&cyclic_lock);
+	cyclic_clear();
+	mutex_unlock(&cyclic_lock);
+}
+module_exit(cyclic_exit);
+
+MODULE_DESCRIPTION("Cyclic Executive Scheduling Module for ChronOS");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,203 @@
+/* chronos/dp_wrap.c
+ *
+ * DP-WRAP Optimal Multiprocessor Scheduler Module for ChronOS
+ *
+ * Time is cut into slices at every deadline in the domain. Within a slice of
+ * length L every task gets a budget of u * L, and the budgets are laid end to
+ * end over the m CPUs of the domain McNaughton style, wrapping from the end of
+ * one CPU to the start of the next. Any task set with utilization of at most
+ * m and no task above 1 meets all deadlines, with at most one preemption per
+ * task and m - 1 migrations per slice.
+ *
+ * Every CPU can work out its own place in the slice, so scheduling runs
+ * concurrently on each CPU, which asks to be rescheduled at its next boundary
+ * through the timed architecture. The budgets are laid out when the slice
+ * starts and kept in the tasks, and the budget of a task that leaves is idled
+ * through. A task that arrives during a slice ends it there, since its
+ * deadline may come before the old boundary: the new slice gives everyone
+ * else what they are still owed of the old one up to the new boundary.
+ *
+ * Copyright (C) 2009-2012 Virginia Tech Real Time Systems Lab
+ */
+
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/smp.h>
+#include <linux/chronos_types.h>
+#include <linux/chronos_sched.h>
+#include <linux/chronos_util.h>
+#include <linux/list.h>
+
+/* Budget in ns of a task for a slice of length len */
+static s64 task_budget(struct rt_info *r, s64 len)
+{
+	s64 period = timespec_to_ns(&r->period);
+	u64 exec = (u64)r->exec_time * NSEC_PER_USEC;
+
+	if(period <= 0 || exec >= period)
+		return len;
+
+	return div64_u64(exec * len, period);
+}
+
+/* How much of a budget laid at offset on the wrapped line has gone by after
+ * elapsed ns of a slice of length len over m CPUs */
+static s64 budget_used(s64 offset, s64 budget, s64 len, s64 elapsed, int m)
+{
+	int i;
+	s64 used = 0, from, to;
+
+	for(i = 0; i < m; i++) {
+		from = max(offset, i * len);
+		to = min(offset + budget, i * len + elapsed);
+		if(to > from)
+			used += to - from;
+	}
+
+	return used;
+}
+
+/* Position of cpu among the CPUs of the domain */
+static int cpu_index(int cpu, struct global_sched_domain *g)
+{
+	int it, index = 0;
+
+	for_each_cpu_mask(it, g->global_sched_mask) {
+		if(it == cpu)
+			break;
+		index++;
+	}
+
+	return index;
+}
+
+/* Start a new slice at now, ending at the next deadline, and lay the budgets
+ * of the tasks there now end to end over it. If the old slice is cut short,
+ * its tasks get their share of it up to the new end, less what they had. */
+static void plan_slice(struct list_head *head, struct global_sched_domain *g, s64 now)
+{
+	int cpu, m = cpumask_weight(&g->global_sched_mask);
+	s64 end = 0, deadline, period = 0, cum = 0, budget;
+	s64 old_start = g->slice_start, old_len = g->slice_end - g->slice_start;
+	struct rt_info *it;
+
+	list_for_each_entry(it, head, task_list[GLOBAL_LIST]) {
+		deadline = timespec_to_ns(&it->deadline);
+		if(deadline > now && (!end || deadline < end))
+			end = deadline;
+
+		if(!period || timespec_to_ns(&it->period) < period)
+			period = timespec_to_ns(&it->period);
+	}
+
+	/* Everyone is past their deadline, so just use the shortest period */
+	if(!end)
+		end = now + (period ? period : NSEC_PER_MSEC);
+
+	list_for_each_entry(it, head, task_list[GLOBAL_LIST]) {
+		if(it->dp_slice == old_start && now < old_start + old_len) {
+			budget = task_budget(it, end - old_start) -
+				budget_used(it->dp_offset, it->dp_budget, old_len,
+					    now - old_start, m);
+			budget = clamp_t(s64, budget, 0, end - now);
+		} else
+			budget = task_budget(it, end - now);
+
+		it->dp_slice = now;
+		it->dp_offset = cum;
+		it->dp_budget = budget;
+		cum += budget;
+	}
+
+	g->slice_start = now;
+	g->slice_end = end;
+
+	/* Everyone else has to find their place in the new slice */
+	for_each_cpu_mask(cpu, g->global_sched_mask) {
+		if(cpu != raw_smp_processor_id())
+			chronos_resched_cpu(cpu);
+	}
+}
+
+/* Whether a task has come in since the slice was laid out */
+static int task_arrived(struct list_head *head, struct global_sched_domain *g)
+{
+	struct rt_info *it;
+
+	list_for_each_entry(it, head, task_list[GLOBAL_LIST]) {
+		if(it->dp_slice != g->slice_start)
+			return 1;
+	}
+
+	return 0;
+}
+
+struct rt_info * sched_dp_wrap(struct list_head *head, struct global_sched_domain *g)
+{
+	int cpu = raw_smp_processor_id();
+	struct rt_info *it, *best = NULL;
+	struct timespec ts;
+	s64 now, len, pos, cpu_start, budget, next;
+
+	getnstimeofday(&ts);
+	now = timespec_to_ns(&ts);
+
+	if(now >= g->slice_end || task_arrived(head, g))
+		plan_slice(head, g, now);
+
+	len = g->slice_end - g->slice_start;
+	cpu_start = cpu_index(cpu, g) * len;
+	pos = cpu_start + (now - g->slice_start);
+	next = g->slice_end;
+
+	/* Find the budget that covers our position on the wrapped line. If
+	 * there is none we idle until the next budget on this CPU starts, or
+	 * the end of the slice. */
+	list_for_each_entry(it, head, task_list[GLOBAL_LIST]) {
+		if(it->dp_slice != g->slice_start)
+			continue;
+
+		budget = it->dp_budget;
+		if(pos >= it->dp_offset && pos < it->dp_offset + budget) {
+			if(task_pullable(it, cpu))
+				best = it;
+			next = g->slice_start + min(len, it->dp_offset + budget - cpu_start);
+			break;
+		}
+
+		if(it->dp_offset > pos && it->dp_offset < cpu_start + len)
+			next = min(next, g->slice_start + it->dp_offset - cpu_start);
+	}
+
+	chronos_resched_cpu_at(cpu, ns_to_ktime(next));
+
+	return best;
+}
+
+struct rt_sched_global dp_wrap = {
+	.base.name = "DP-WRAP",
+	.base.id = SCHED_RT_DP_WRAP,
+	.schedule = sched_dp_wrap,
+	.preschedule = presched_stw_generic,
+	.arch = &rt_sched_arch_timed,
+	.local = SCHED_RT_FIFO,
+	.base.sort_key = SORT_KEY_NONE,
+	.base.list = LIST_HEAD_INIT(dp_wrap.base.list)
+};
+
+static int __init dp_wrap_init(void)
+{
+	return add_global_scheduler(&dp_wrap);
+}
+module_init(dp_wrap_init);
+
+static void __exit dp_wrap_exit(void)
+{
+	remove_global_scheduler(&dp_wrap);
+}
+module_exit(dp_wrap_exit);
+
+MODULE_DESCRIPTION("DP-WRAP Optimal Multiprocessor Scheduling Module for ChronOS");
+MODULE_LICENSE("GPL");
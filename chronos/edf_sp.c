@@ -0,0 +1,253 @@
+/* chronos/edf_sp.c
+ *
+ * Semi-Partitioned EDF Scheduler Module for ChronOS
+ *
+ * Tasks are assigned to CPUs first-fit by utilization and keep both the CPU
+ * and the utilization they reserved there across segments, until they exit.
+ * A task that fits on no single CPU is split C=D style: its first piece fills
+ * the free capacity of the least loaded CPU with a deadline equal to its
+ * budget, so it runs with zero laxity, and the rest of the job migrates to a
+ * second CPU once that budget is used. A task that does not fit even split is
+ * refused: it is aborted and only runs on CPUs with no placed work, long
+ * enough to end its segment. Each CPU then runs EDF over the pieces assigned
+ * to it, and the pull path moves tasks only at those points.
+ *
+ * Copyright (C) 2009-2012 Virginia Tech Real Time Systems Lab
+ */
+
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/chronos_types.h>
+#include <linux/chronos_global.h>
+#include <linux/chronos_sched.h>
+#include <linux/chronos_util.h>
+#include <linux/list.h>
+
+/* Utilizations are kept in parts per million of a CPU */
+#define SP_UTIL_SCALE		MILLION
+
+/* Timers that bring a CPU back into the scheduler when the split task running
+ * on it has used up its budget there */
+struct sp_budget_timer {
+	struct hrtimer timer;
+	int cpu;
+};
+
+static DEFINE_PER_CPU(struct sp_budget_timer, sp_timer);
+
+static long task_util(struct rt_info *r)
+{
+	u64 period = timespec_to_ns(&r->period);
+
+	if(!period)
+		return SP_UTIL_SCALE;
+
+	return (long)div64_u64((u64)r->exec_time * NSEC_PER_USEC * SP_UTIL_SCALE, period);
+}
+
+static long cpu_free(int cpu)
+{
+	return SP_UTIL_SCALE - atomic_long_read(&per_cpu(chronos_cpu_reserved, cpu));
+}
+
+/* Execution time a task has left in its piece on this CPU */
+static long piece_left(struct rt_info *r, int cpu)
+{
+	long used = r->exec_time - calc_left(r);
+
+	if(r->split_cpu < 0 || cpu != r->home_cpu)
+		return calc_left(r);
+
+	return r->split_budget > used ? r->split_budget - used : 0;
+}
+
+/* The CPU that the piece the task is currently executing belongs to */
+static int piece_cpu(struct rt_info *r)
+{
+	if(r->split_cpu >= 0 && !piece_left(r, r->home_cpu))
+		return r->split_cpu;
+
+	return r->home_cpu;
+}
+
+/* Whether the place a task holds is in this domain and still covers it */
+static int assigned(struct rt_info *r, struct global_sched_domain *g)
+{
+	return r->home_cpu >= 0 && cpumask_test_cpu(r->home_cpu, &g->global_sched_mask) &&
+		(r->split_cpu < 0 || cpumask_test_cpu(r->split_cpu, &g->global_sched_mask)) &&
+		task_util(r) <= r->home_util + r->split_util;
+}
+
+/* First-fit a task, splitting it over two CPUs if it has to be. Returns
+ * -ENOSPC, leaving the task without a place, if it fits nowhere. */
+static int assign_task(struct rt_info *r, struct global_sched_domain *g)
+{
+	int cpu, emptiest = -1;
+	long util, free, most_free = 0;
+
+	/* Give back whatever the task held before sizing it up again */
+	chronos_release_place(r);
+	util = task_util(r);
+
+	for_each_cpu_mask(cpu, g->global_sched_mask) {
+		free = cpu_free(cpu);
+		if(free >= util) {
+			chronos_reserve_place(r, cpu, util, -1, 0);
+			return 0;
+		}
+
+		if(free > most_free) {
+			most_free = free;
+			emptiest = cpu;
+		}
+	}
+
+	if(emptiest < 0)
+		return -ENOSPC;
+
+	for_each_cpu_mask(cpu, g->global_sched_mask) {
+		if(cpu == emptiest || cpu_free(cpu) < util - most_free)
+			continue;
+
+		chronos_reserve_place(r, emptiest, most_free, cpu, util - most_free);
+		r->split_budget = div_u64(div_u64(timespec_to_ns(&r->period), NSEC_PER_USEC) *
+					  most_free, SP_UTIL_SCALE);
+		return 0;
+	}
+
+	return -ENOSPC;
+}
+
+/* C=D: the first piece of a split task must finish within its budget of its
+ * release, everything else keeps the deadline of the job */
+static void set_piece_deadline(struct rt_info *r)
+{
+	struct timespec budget;
+
+	r->temp_deadline = r->deadline;
+
+	if(r->split_cpu >= 0 && piece_cpu(r) == r->home_cpu) {
+		budget = ns_to_timespec((s64)r->split_budget * NSEC_PER_USEC);
+		sub_ts(&r->deadline, &r->period, &r->temp_deadline);
+		add_ts(&r->temp_deadline, &budget, &r->temp_deadline);
+	}
+}
+
+static enum hrtimer_restart sp_budget_expired(struct hrtimer *timer)
+{
+	struct sp_budget_timer *t = container_of(timer, struct sp_budget_timer, timer);
+
+	chronos_resched_cpu(t->cpu);
+	return HRTIMER_NORESTART;
+}
+
+static void arm_budget_timer(struct rt_info *r, int cpu)
+{
+	struct hrtimer *timer = &per_cpu(sp_timer, cpu).timer;
+
+	hrtimer_try_to_cancel(timer);
+
+	if(r && r->split_cpu >= 0 && cpu == r->home_cpu)
+		hrtimer_start(timer, ns_to_ktime((u64)piece_left(r, cpu) * THOUSAND),
+			      HRTIMER_MODE_REL);
+}
+
+struct rt_info * sched_edf_sp(struct list_head *head, struct global_sched_domain *g)
+{
+	int cpu;
+	struct rt_info *it, *best = NULL;
+	struct cpu_info *state;
+
+	for_each_cpu_mask(cpu, g->global_sched_mask) {
+		state = get_cpu_state(cpu);
+		state->head = NULL;
+		state->tail = NULL;
+	}
+
+	/* Place the new tasks, and pick the earliest piece for each CPU */
+	list_for_each_entry(it, head, task_list[GLOBAL_LIST]) {
+		if(!assigned(it, g) && assign_task(it, g)) {
+			if(!check_task_aborted(it))
+				abort_thread(it);
+			continue;
+		}
+
+		set_piece_deadline(it);
+		cpu = piece_cpu(it);
+		if(!task_pullable(it, cpu))
+			continue;
+
+		state = get_cpu_state(cpu);
+		if(!state->head || earlier_deadline(&it->temp_deadline, &state->head->temp_deadline))
+			state->head = it;
+	}
+
+	/* Refused tasks only get the CPUs nothing placed wants, to abort on */
+	list_for_each_entry(it, head, task_list[GLOBAL_LIST]) {
+		if(it->home_cpu >= 0)
+			continue;
+
+		for_each_cpu_mask(cpu, g->global_sched_mask) {
+			state = get_cpu_state(cpu);
+			if(!state->head && !state->tail && task_pullable(it, cpu)) {
+				state->tail = it;
+				break;
+			}
+		}
+	}
+
+	for_each_cpu_mask(cpu, g->global_sched_mask) {
+		state = get_cpu_state(cpu);
+		arm_budget_timer(state->head, cpu);
+		if(!state->head)
+			state->head = state->tail;
+		if(state->head)
+			best = state->head;
+	}
+
+	return best;
+}
+
+struct rt_sched_global edf_sp = {
+	.base.name = "EDF-SP",
+	.base.id = SCHED_RT_EDF_SP,
+	.schedule = sched_edf_sp,
+	.preschedule = presched_stw_generic,
+	.arch = &rt_sched_arch_stw_partitioned,
+	.local = SCHED_RT_FIFO,
+	.base.sort_key = SORT_KEY_DEADLINE,
+	.base.list = LIST_HEAD_INIT(edf_sp.base.list)
+};
+
+static int __init edf_sp_init(void)
+{
+	int cpu;
+	struct sp_budget_timer *t;
+
+	for_each_possible_cpu(cpu) {
+		t = &per_cpu(sp_timer, cpu);
+		hrtimer_init(&t->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		t->timer.function = sp_budget_expired;
+		t->timer.irqsafe = 1;
+		t->cpu = cpu;
+	}
+
+	return add_global_scheduler(&edf_sp);
+}
+module_init(edf_sp_init);
+
+static void __exit edf_sp_exit(void)
+{
+	int cpu;
+
+	remove_global_scheduler(&edf_sp);
+
+	for_each_possible_cpu(cpu)
+		hrtimer_cancel(&per_cpu(sp_timer, cpu).timer);
+}
+module_exit(edf_sp_exit);
+
+MODULE_DESCRIPTION("Semi-Partitioned EDF Scheduling Module for ChronOS");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,499 @@
+/* chronos/federated.c
+ *
+ * Federated Scheduling Module for parallel DAG tasks in ChronOS
+ *
+ * A DAG task is a set of threads (nodes) with precedence edges between them,
+ * a WCET for each node and one relative deadline. It is described through
+ * /proc/chronos/federated:
+ *
+ *	dag <id> <deadline us>			starts describing a DAG
+ *	node <id> <node> <wcet us> <tid>	adds node, run by thread tid
+ *	edge <id> <from> <to>			from must finish before to starts
+ *	commit <id>				admits the DAG
+ *	remove <id>				takes it out again
+ *
+ * On commit the work C (the sum of the WCETs) and the span L (the longest
+ * path) are worked out. A heavy DAG, one with C > D, gets a cluster of
+ * ceil((C - L) / (D - L)) CPUs to itself, with its own global domain. Light
+ * DAGs are run as sequential tasks on the CPUs left over: each is packed
+ * first-fit by its density C / D onto one of them, is only admitted if it
+ * fits, and runs there under a local scheduler, EDF by default. The domains
+ * are rebuilt and the threads moved onto their CPUs every time the set of
+ * DAGs changes, so DAGs should be admitted before their threads start
+ * real-time segments. The edges are only used to work out the span: the
+ * threads themselves are responsible for waiting on their predecessors.
+ *
+ * Copyright (C) 2009-2012 Virginia Tech Real Time Systems Lab
+ */
+
+#include <linux/bitmap.h>
+#include <linux/cpumask.h>
+#include <linux/list.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/pid.h>
+#include <linux/proc_fs.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/chronos_types.h>
+#include <linux/chronos_sched.h>
+
+#define FED_MAX_NODES		64
+#define FED_UNIT		1000000		/* a whole CPU, for densities */
+
+static int cluster_sched = SCHED_RT_GFIFO;
+module_param(cluster_sched, int, 0444);
+MODULE_PARM_DESC(cluster_sched, "Global scheduler for the cluster of each heavy DAG");
+
+static int light_sched = SCHED_RT_EDF;
+module_param(light_sched, int, 0444);
+MODULE_PARM_DESC(light_sched, "Local scheduler for the CPUs shared by light DAGs");
+
+static int prio = 50;
+module_param(prio, int, 0444);
+MODULE_PARM_DESC(prio, "Priority of the domains");
+
+static ulong cpus;
+module_param(cpus, ulong, 0444);
+MODULE_PARM_DESC(cpus, "Mask of CPUs to federate (default: all online)");
+
+struct fed_node {
+	unsigned long wcet;		/* us */
+	pid_t tid;
+	DECLARE_BITMAP(succ, FED_MAX_NODES);
+};
+
+struct fed_dag {
+	struct list_head list;
+	int id;
+	int committed;
+	unsigned long deadline;		/* us */
+	int nr_nodes;
+	struct fed_node nodes[FED_MAX_NODES];
+	/* Worked out on commit */
+	unsigned long work;
+	unsigned long span;
+	int nr_cpus;			/* 0 if light */
+	cpumask_t mask;			/* cluster, or CPU of a light DAG */
+};
+
+static LIST_HEAD(fed_dags);
+static DEFINE_MUTEX(fed_lock);
+static cpumask_t fed_mask;
+static cpumask_t light_mask;
+static unsigned long fed_load[NR_CPUS];	/* scratch for fed_light_fits() */
+
+static struct fed_dag *find_dag(int id)
+{
+	struct fed_dag *d;
+
+	list_for_each_entry(d, &fed_dags, list) {
+		if(d->id == id)
+			return d;
+	}
+
+	return NULL;
+}
+
+/* Work out the work and span of a DAG, going through it in topological
+ * order. Fails if the edges have a cycle. */
+static int dag_measure(struct fed_dag *d)
+{
+	int i, j, done = 0, in[FED_MAX_NODES];
+	unsigned long finish[FED_MAX_NODES];
+	DECLARE_BITMAP(ready, FED_MAX_NODES);
+
+	memset(in, 0, sizeof(in));
+	memset(finish, 0, sizeof(finish));
+	bitmap_zero(ready, FED_MAX_NODES);
+
+	d->work = d->span = 0;
+	for(i = 0; i < d->nr_nodes; i++) {
+		d->work += d->nodes[i].wcet;
+		for_each_set_bit(j, d->nodes[i].succ, d->nr_nodes)
+			in[j]++;
+	}
+
+	for(i = 0; i < d->nr_nodes; i++) {
+		if(!in[i])
+			set_bit(i, ready);
+	}
+
+	while((i = find_first_bit(ready, d->nr_nodes)) < d->nr_nodes) {
+		clear_bit(i, ready);
+		done++;
+
+		finish[i] += d->nodes[i].wcet;
+		d->span = max(d->span, finish[i]);
+
+		for_each_set_bit(j, d->nodes[i].succ, d->nr_nodes) {
+			finish[j] = max(finish[j], finish[i]);
+			if(!--in[j])
+				set_bit(j, ready);
+		}
+	}
+
+	return done == d->nr_nodes ? 0 : -EINVAL;
+}
+
+/* Dedicated CPUs a DAG needs, ceil((C - L) / (D - L)), or 0 if it is light */
+static int dag_cpus(struct fed_dag *d)
+{
+	if(d->work <= d->deadline)
+		return 0;
+
+	return DIV_ROUND_UP(d->work - d->span, d->deadline - d->span);
+}
+
+/* Partition the light DAGs: each runs as a sequential task of density C / D
+ * on the first of the CPUs left over that it fits on under EDF */
+static int fed_light_fits(cpumask_t *left)
+{
+	int cpu;
+	unsigned long density;
+	struct fed_dag *d;
+
+	memset(fed_load, 0, sizeof(fed_load));
+
+	list_for_each_entry(d, &fed_dags, list) {
+		if(!d->committed || d->nr_cpus)
+			continue;
+
+		density = DIV_ROUND_UP(d->work * FED_UNIT, d->deadline);
+		for_each_cpu(cpu, left) {
+			if(fed_load[cpu] + density <= FED_UNIT)
+				break;
+		}
+
+		if(cpu >= nr_cpu_ids)
+			return -ENOSPC;
+
+		fed_load[cpu] += density;
+		cpumask_set_cpu(cpu, &d->mask);
+	}
+
+	return 0;
+}
+
+/* Hand out clusters to the heavy DAGs, in the order they were admitted, and
+ * check that the light DAGs fit on what is left */
+static int fed_partition(void)
+{
+	int i, cpu, ret;
+	struct fed_dag *d;
+	cpumask_t left;
+
+	cpumask_copy(&left, &fed_mask);
+
+	list_for_each_entry(d, &fed_dags, list) {
+		if(!d->committed)
+			continue;
+
+		cpumask_clear(&d->mask);
+		if(!d->nr_cpus)
+			continue;
+
+		if(cpumask_weight(&left) < d->nr_cpus)
+			return -ENOSPC;
+
+		for(i = 0; i < d->nr_cpus; i++) {
+			cpu = cpumask_first(&left);
+			cpumask_clear_cpu(cpu, &left);
+			cpumask_set_cpu(cpu, &d->mask);
+		}
+	}
+
+	ret = fed_light_fits(&left);
+	if(ret)
+		return ret;
+
+	cpumask_copy(&light_mask, &left);
+	return 0;
+}
+
+static int fed_find_sched(int sched, struct rt_sched_local **l,
+			  struct rt_sched_global **g)
+{
+	*g = get_global_scheduler(sched);
+	*l = *g ? get_local_scheduler((*g)->local) : NULL;
+
+	if(!*l) {
+		printk("federated: scheduler %d not found!\n", sched);
+		return -ENOENT;
+	}
+
+	return 0;
+}
+
+static void fed_move_threads(struct fed_dag *d, cpumask_t *mask)
+{
+	int i;
+	struct pid *pid;
+	struct task_struct *p;
+
+	for(i = 0; i < d->nr_nodes; i++) {
+		pid = find_get_pid(d->nodes[i].tid);
+		p = get_pid_task(pid, PIDTYPE_PID);
+		put_pid(pid);
+
+		if(p) {
+			set_cpus_allowed_ptr(p, mask);
+			put_task_struct(p);
+		}
+	}
+}
+
+/* Build a domain for every cluster, put the light CPUs under the local
+ * scheduler, and move the threads of every DAG onto its CPUs. The schedulers
+ * are looked up before anything is changed; if building a domain fails part
+ * way the caller puts the previous partition back. */
+static int fed_apply(void)
+{
+	int ret;
+	struct fed_dag *d;
+	struct rt_sched_local *cl, *ll;
+	struct rt_sched_global *cg;
+
+	ret = fed_find_sched(cluster_sched, &cl, &cg);
+	if(ret)
+		return ret;
+
+	ll = get_local_scheduler(light_sched);
+	if(!ll) {
+		printk("federated: scheduler %d not found!\n", light_sched);
+		return -ENOENT;
+	}
+
+	list_for_each_entry(d, &fed_dags, list) {
+		if(!d->committed || !d->nr_cpus)
+			continue;
+
+		ret = set_scheduler_mask(cl, cg, &d->mask, prio);
+		if(ret)
+			return ret;
+	}
+
+	if(!cpumask_empty(&light_mask)) {
+		ret = set_scheduler_mask(ll, NULL, &light_mask, 0);
+		if(ret)
+			return ret;
+	}
+
+	list_for_each_entry(d, &fed_dags, list) {
+		if(d->committed)
+			fed_move_threads(d, &d->mask);
+	}
+
+	return 0;
+}
+
+static int fed_commit(struct fed_dag *d)
+{
+	int ret;
+
+	if(d->committed || !d->nr_nodes)
+		return -EINVAL;
+
+	ret = dag_measure(d);
+	if(ret)
+		return ret;
+
+	/* No number of CPUs can help if the span is over the deadline */
+	if(d->span > d->deadline || (d->span == d->deadline && d->work > d->deadline))
+		return -EINVAL;
+
+	d->nr_cpus = dag_cpus(d);
+	d->committed = 1;
+
+	ret = fed_partition();
+	if(!ret)
+		ret = fed_apply();
+
+	/* Go back to the partition the other DAGs had */
+	if(ret) {
+		d->committed = 0;
+		fed_partition();
+		fed_apply();
+	}
+
+	return ret;
+}
+
+static int fed_parse(char *line)
+{
+	int id, a, b;
+	unsigned long us;
+	struct fed_dag *d;
+
+	if(!*line)
+		return 0;
+
+	if(sscanf(line, "dag %d %lu", &id, &us) == 2) {
+		if(find_dag(id) || !us)
+			return -EINVAL;
+
+		d = kzalloc(sizeof(*d), GFP_KERNEL);
+		if(!d)
+			return -ENOMEM;
+
+		d->id = id;
+		d->deadline = us;
+		list_add_tail(&d->list, &fed_dags);
+		return 0;
+	}
+
+	if(sscanf(line, "node %d %d %lu %d", &id, &a, &us, &b) == 4) {
+		d = find_dag(id);
+		if(!d || d->committed || a != d->nr_nodes || a >= FED_MAX_NODES)
+			return -EINVAL;
+
+		d->nodes[a].wcet = us;
+		d->nodes[a].tid = b;
+		d->nr_nodes++;
+		return 0;
+	}
+
+	if(sscanf(line, "edge %d %d %d", &id, &a, &b) == 3) {
+		d = find_dag(id);
+		if(!d || d->committed || a < 0 || b < 0 ||
+		   a >= d->nr_nodes || b >= d->nr_nodes || a == b)
+			return -EINVAL;
+
+		set_bit(b, d->nodes[a].succ);
+		return 0;
+	}
+
+	if(sscanf(line, "commit %d", &id) == 1) {
+		d = find_dag(id);
+		return d ? fed_commit(d) : -EINVAL;
+	}
+
+	if(sscanf(line, "remove %d", &id) == 1) {
+		d = find_dag(id);
+		if(!d)
+			return -EINVAL;
+
+		list_del(&d->list);
+		if(d->committed) {
+			fed_partition();
+			fed_apply();
+		}
+		kfree(d);
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+static ssize_t fed_write(struct file *filp, const char __user *ubuf,
+			 size_t count, loff_t *ppos)
+{
+	char *buf, *line, *pos;
+	int ret = 0;
+
+	if(count >= PAGE_SIZE)
+		return -EINVAL;
+
+	buf = kmalloc(count + 1, GFP_KERNEL);
+	if(!buf)
+		return -ENOMEM;
+
+	if(copy_from_user(buf, ubuf, count)) {
+		kfree(buf);
+		return -EFAULT;
+	}
+	buf[count] = '\0';
+
+	mutex_lock(&fed_lock);
+	pos = buf;
+	while(!ret && (line = strsep(&pos, "\n")) != NULL)
+		ret = fed_parse(strim(line));
+	mutex_unlock(&fed_lock);
+
+	kfree(buf);
+	return ret ? ret : count;
+}
+
+static int fed_show(struct seq_file *m, void *v)
+{
+	struct fed_dag *d;
+	char mask[64];
+
+	mutex_lock(&fed_lock);
+	list_for_each_entry(d, &fed_dags, list) {
+		seq_printf(m, "dag %d: %s deadline %lu work %lu span %lu nodes %d",
+			   d->id, d->committed ? "admitted" : "pending",
+			   d->deadline, d->work, d->span, d->nr_nodes);
+
+		if(d->committed && d->nr_cpus) {
+			cpumask_scnprintf(mask, sizeof(mask), &d->mask);
+			seq_printf(m, " cpus %s", mask);
+		} else if(d->committed)
+			seq_printf(m, " light on cpu %d", cpumask_first(&d->mask));
+
+		seq_printf(m, "\n");
+	}
+
+	cpumask_scnprintf(mask, sizeof(mask), &light_mask);
+	seq_printf(m, "light cpus %s\n", mask);
+	mutex_unlock(&fed_lock);
+
+	return 0;
+}
+
+static int fed_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, fed_show, NULL);
+}
+
+static const struct file_operations fed_fops = {
+	.owner		= THIS_MODULE,
+	.open		= fed_open,
+	.read		= seq_read,
+	.write		= fed_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init fed_init(void)
+{
+	if(cpus)
+		bitmap_copy(cpumask_bits(&fed_mask), &cpus, min_t(int, nr_cpu_ids, BITS_PER_LONG));
+	else
+		cpumask_copy(&fed_mask, cpu_online_mask);
+	cpumask_and(&fed_mask, &fed_mask, cpu_online_mask);
+
+	if(cpumask_empty(&fed_mask))
+		return -EINVAL;
+
+	cpumask_copy(&light_mask, &fed_mask);
+
+	if(!proc_create("chronos/federated", 0644, NULL, &fed_fops))
+		return -ENOMEM;
+
+	return 0;
+}
+module_init(fed_init);
+
+static void __exit fed_exit(void)
+{
+	struct fed_dag *d, *tmp;
+	struct rt_sched_local *l_sched = get_local_scheduler(SCHED_RT_FIFO);
+
+	remove_proc_entry("chronos/federated", NULL);
+
+	list_for_each_entry_safe(d, tmp, &fed_dags, list) {
+		list_del(&d->list);
+		kfree(d);
+	}
+
+	if(l_sched)
+		set_scheduler_mask(l_sched, NULL, &fed_mask, 0);
+}
+module_exit(fed_exit);
+
+MODULE_DESCRIPTION("Federated DAG Scheduling Module for ChronOS");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,60 @@
+/* chronos/gedf_gang.c
+ *
+ * Global EDF Gang Scheduler Module for ChronOS
+ *
+ * Threads of a parallel job register as a gang (RT_SEG_SET_GANG) and begin
+ * their segments with the deadline of the job. The domain runs global EDF, but
+ * the gang mapping function dispatches the runnable threads of a gang all in
+ * the same round on distinct CPUs, or leaves all of them queued, so that none
+ * of them spin at a barrier waiting on a sibling that is not running.
+ *
+ * Copyright (C) 2009-2012 Virginia Tech Real Time Systems Lab
+ */
+
+#include <linux/module.h>
+#include <linux/chronos_types.h>
+#include <linux/chronos_sched.h>
+#include <linux/list.h>
+
+/* Hand every task to the mapping function in deadline order */
+struct rt_info * sched_gedf_gang(struct list_head *head, struct global_sched_domain *g)
+{
+	struct rt_info *it, *best = NULL;
+
+	list_for_each_entry(it, head, task_list[GLOBAL_LIST]) {
+		if(best)
+			list_add_before(best, it, SCHED_LIST1);
+		else {
+			best = it;
+			INIT_LIST_HEAD(&best->task_list[SCHED_LIST1]);
+		}
+	}
+
+	return best;
+}
+
+struct rt_sched_global gedf_gang = {
+	.base.name = "GEDF-GANG",
+	.base.id = SCHED_RT_GEDF_GANG,
+	.schedule = sched_gedf_gang,
+	.preschedule = presched_stw_generic,
+	.arch = &rt_sched_arch_stw_gang,
+	.local = SCHED_RT_FIFO,
+	.base.sort_key = SORT_KEY_DEADLINE,
+	.base.list = LIST_HEAD_INIT(gedf_gang.base.list)
+};
+
+static int __init gedf_gang_init(void)
+{
+	return add_global_scheduler(&gedf_gang);
+}
+module_init(gedf_gang_init);
+
+static void __exit gedf_gang_exit(void)
+{
+	remove_global_scheduler(&gedf_gang);
+}
+module_exit(gedf_gang_exit);
+
+MODULE_DESCRIPTION("Global EDF Gang Scheduling Module for ChronOS");
+MODULE_LICENSE("GPL");
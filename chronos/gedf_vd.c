@@ -0,0 +1,204 @@
+/* chronos/gedf_vd.c
+ *
+ * Global EDF-VD Mixed-Criticality Scheduler Module for ChronOS
+ *
+ * Tasks are either LO or HI criticality, and HI tasks carry a WCET for each
+ * level (see RT_SEG_SET_CRIT). While the domain is in LO mode every task runs
+ * under EDF, but HI tasks do so with their deadlines shortened by the EDF-VD
+ * factor x = U_HI(LO) / (m - U_LO(LO)), so that they have slack left over
+ * should they need their HI WCET.
+ *
+ * As soon as a HI task is seen to have run past its LO WCET the domain
+ * switches to HI mode: HI tasks go back to their real deadlines and LO tasks
+ * are only run on CPUs the HI tasks leave idle. The switch is a single flag, so
+ * LO tasks are dropped in O(1). The mode is kept in the domain, and it only
+ * returns to LO mode at an idle instant, once nothing is left on its global
+ * list (see _remove_task_global()).
+ *
+ * Copyright (C) 2009-2012 Virginia Tech Real Time Systems Lab
+ */
+
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/smp.h>
+#include <linux/chronos_types.h>
+#include <linux/chronos_sched.h>
+#include <linux/chronos_util.h>
+#include <linux/list.h>
+
+/* Utilizations and the scaling factor are kept in parts per million */
+#define VD_UTIL_SCALE		MILLION
+
+static int is_hi(struct rt_info *r)
+{
+	return r->critinfo.level >= CRIT_HI;
+}
+
+static long task_util(struct rt_info *r)
+{
+	unsigned long period = timespec_to_long(&r->period);
+
+	if(!period)
+		return VD_UTIL_SCALE;
+
+	return (long)div_u64((u64)r->critinfo.exec_time[CRIT_LO] * VD_UTIL_SCALE, period);
+}
+
+/* CPU time a HI task has left before it overruns its LO WCET, in ns */
+static s64 lo_budget_left(struct rt_info *r)
+{
+	return (s64)r->critinfo.exec_time[CRIT_LO] * NSEC_PER_USEC - (s64)__seg_runtime(r);
+}
+
+/* The EDF-VD deadline scaling factor, for the m CPUs of the domain */
+static long scale_factor(struct list_head *head, int cpus)
+{
+	long u_lo = 0, u_hi = 0, spare;
+	struct rt_info *it;
+
+	list_for_each_entry(it, head, task_list[GLOBAL_LIST]) {
+		if(is_hi(it))
+			u_hi += task_util(it);
+		else
+			u_lo += task_util(it);
+	}
+
+	spare = cpus * VD_UTIL_SCALE - u_lo;
+	if(spare <= u_hi)
+		return VD_UTIL_SCALE;
+
+	return (long)div_u64((u64)u_hi * VD_UTIL_SCALE, spare);
+}
+
+/* Virtual deadline of a HI task, release + x * period */
+static void set_virtual_deadline(struct rt_info *r, long x)
+{
+	struct timespec vd;
+
+	long_to_timespec(div_u64((u64)timespec_to_long(&r->period) * x, VD_UTIL_SCALE), &vd);
+	sub_ts(&r->deadline, &r->period, &r->temp_deadline);
+	add_ts(&r->temp_deadline, &vd, &r->temp_deadline);
+}
+
+static void add_candidate(struct rt_info *r, struct rt_info **best, int cpus, int sorted)
+{
+	INIT_LIST_HEAD(&r->task_list[SCHED_LIST1]);
+
+	if(!*best)
+		*best = r;
+	else if(!sorted)
+		list_add_before(*best, r, SCHED_LIST1);
+	else if(insert_on_list(r, *best, SCHED_LIST1, SORT_KEY_TDEADLINE, 0))
+		*best = r;
+
+	trim_list(*best, SCHED_LIST1, cpus);
+}
+
+/* HI mode: HI tasks by deadline, then LO tasks on whatever is left. The
+ * global list is already in deadline order. */
+static struct rt_info * sched_hi_mode(struct list_head *head, int cpus)
+{
+	int count = 0, pass;
+	struct rt_info *it, *best = NULL;
+
+	for(pass = CRIT_HI; pass >= CRIT_LO; pass--) {
+		list_for_each_entry(it, head, task_list[GLOBAL_LIST]) {
+			if(count == cpus)
+				return best;
+
+			if(is_hi(it) == (pass == CRIT_HI)) {
+				add_candidate(it, &best, cpus, 0);
+				count++;
+			}
+		}
+	}
+
+	return best;
+}
+
+/* LO mode: EDF on virtual deadlines, with a timer at the first point any of
+ * the running HI tasks could overrun */
+static struct rt_info * sched_lo_mode(struct list_head *head, int cpus)
+{
+	long x = scale_factor(head, cpus);
+	s64 left, next = 0;
+	struct rt_info *it, *best = NULL;
+	struct timespec now;
+
+	list_for_each_entry(it, head, task_list[GLOBAL_LIST]) {
+		if(is_hi(it))
+			set_virtual_deadline(it, x);
+		else
+			it->temp_deadline = it->deadline;
+
+		add_candidate(it, &best, cpus, 1);
+	}
+
+	if(!best)
+		return NULL;
+
+	it = best;
+	do {
+		if(is_hi(it)) {
+			left = lo_budget_left(it);
+			if(!next || left < next)
+				next = left;
+		}
+		it = task_list_entry(it->task_list[SCHED_LIST1].next, SCHED_LIST1);
+	} while(it != best);
+
+	if(next) {
+		getnstimeofday(&now);
+		chronos_resched_cpu_at(raw_smp_processor_id(),
+				       ns_to_ktime(timespec_to_ns(&now) + next));
+	}
+
+	return best;
+}
+
+struct rt_info * sched_gedf_vd(struct list_head *head, struct global_sched_domain *g)
+{
+	int cpus = count_global_cpus(g);
+	struct rt_info *it;
+
+	if(g->crit_mode == CRIT_LO) {
+		list_for_each_entry(it, head, task_list[GLOBAL_LIST]) {
+			if(is_hi(it) && lo_budget_left(it) <= 0) {
+				g->crit_mode = CRIT_HI;
+				break;
+			}
+		}
+	}
+
+	if(g->crit_mode == CRIT_HI)
+		return sched_hi_mode(head, cpus);
+
+	return sched_lo_mode(head, cpus);
+}
+
+struct rt_sched_global gedf_vd = {
+	.base.name = "GEDF-VD",
+	.base.id = SCHED_RT_GEDF_VD,
+	.schedule = sched_gedf_vd,
+	.preschedule = presched_stw_generic,
+	.arch = &rt_sched_arch_stw,
+	.local = SCHED_RT_FIFO,
+	.base.sort_key = SORT_KEY_DEADLINE,
+	.base.list = LIST_HEAD_INIT(gedf_vd.base.list)
+};
+
+static int __init gedf_vd_init(void)
+{
+	return add_global_scheduler(&gedf_vd);
+}
+module_init(gedf_vd_init);
+
+static void __exit gedf_vd_exit(void)
+{
+	remove_global_scheduler(&gedf_vd);
+}
+module_exit(gedf_vd_exit);
+
+MODULE_DESCRIPTION("Global EDF-VD Mixed-Criticality Scheduling Module for ChronOS");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,43 @@
+/* chronos/gedf_ws.c
+ *
+ * Work-Stealing Global EDF Scheduler Module for ChronOS
+ *
+ * Each CPU runs its own tasks EDF, and a CPU with none of its own at the
+ * domain's priority steals the queued task with the earliest deadline from its
+ * peers (see rt_sched_arch_steal). There is no global scheduling decision, and
+ * tasks are never put on the domain's global list, so neither segments nor
+ * scheduling take a domain-wide lock, at the cost of EDF only holding among
+ * the tasks queued on each CPU.
+ *
+ * Copyright (C) 2009-2012 Virginia Tech Real Time Systems Lab
+ */
+
+#include <linux/module.h>
+#include <linux/chronos_types.h>
+#include <linux/chronos_sched.h>
+#include <linux/list.h>
+
+struct rt_sched_global gedf_ws = {
+	.base.name = "GEDF-WS",
+	.base.id = SCHED_RT_GEDF_WS,
+	.preschedule = presched_steal,
+	.arch = &rt_sched_arch_steal,
+	.local = SCHED_RT_EDF,
+	.base.sort_key = SORT_KEY_DEADLINE,
+	.base.list = LIST_HEAD_INIT(gedf_ws.base.list)
+};
+
+static int __init gedf_ws_init(void)
+{
+	return add_global_scheduler(&gedf_ws);
+}
+module_init(gedf_ws_init);
+
+static void __exit gedf_ws_exit(void)
+{
+	remove_global_scheduler(&gedf_ws);
+}
+module_exit(gedf_ws_exit);
+
+MODULE_DESCRIPTION("Work-Stealing Global EDF Scheduling Module for ChronOS");
+MODULE_LICENSE("GPL");
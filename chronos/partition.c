@@ -0,0 +1,371 @@
+/* chronos/partition.c
+ *
+ * Temporal Partitioning Module for ChronOS
+ *
+ * Splits time into a repeating major frame of windows, ARINC 653 style. A
+ * partition is a ChronOS priority, with whatever local tasks and global
+ * domain run at it, and each window opens a set of partitions on a set of
+ * CPUs. The windows are loaded through /proc/chronos/partition:
+ *
+ *	frame <us>				starts a new, empty schedule
+ *	<cpus> <offset us> <prios>		opens a window, e.g. "0-3 2000 10,12"
+ *	start					switches windows from the next frame
+ *
+ * cpus is a CPU list and prios a list of ChronOS priorities, or "-" for a
+ * window in which no partition runs. Windows must be given in increasing
+ * order of offset for each CPU, and each lasts until the next one on that CPU,
+ * the last wrapping around into the next frame. Frames are aligned to
+ * CLOCK_REALTIME.
+ *
+ * Only the priorities named in some window of a CPU are partitioned there,
+ * everything else runs as before. While a window is open on a CPU, the
+ * partitioned priorities it does not name are closed: nothing queued at them
+ * is picked, and their global domain is not scheduled, so that the existing
+ * local and global schedulers decide among the open partitions unchanged.
+ * Each CPU has a pinned timer which closes and opens priorities at every
+ * window boundary and reschedules. A global domain should be given the same
+ * windows on all of its CPUs. Hierarchical servers (chronos/servers.c) switch
+ * the same priorities, so only one of the two can be started at a time.
+ *
+ * Closing a priority closes it for every SCHED_FIFO task at it, not only the
+ * ChronOS ones, so partitions must not share a priority with other real-time
+ * work. The priority irq threads run at, MAX_USER_RT_PRIO / 2, is refused.
+ *
+ * Copyright (C) 2009-2012 Virginia Tech Real Time Systems Lab
+ */
+
+#include <linux/bitmap.h>
+#include <linux/cpumask.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/chronos_types.h>
+#include <linux/chronos_sched.h>
+#include <linux/chronos_util.h>
+
+#define PARTITION_MAX_WINDOWS	32
+
+struct partition_window {
+	u64 offset;			/* ns into the frame */
+	/* ChronOS priorities the window opens, and the kernel priorities it
+	 * closes, filled in at start */
+	DECLARE_BITMAP(open, MAX_RT_PRIO);
+	DECLARE_BITMAP(closed, MAX_RT_PRIO);
+};
+
+struct partition_cpu {
+	struct hrtimer timer;
+	int cpu;
+	int nr_windows;
+	/* Start of the frame the timer is set in */
+	u64 epoch;
+	struct partition_window windows[PARTITION_MAX_WINDOWS];
+};
+
+static DEFINE_PER_CPU(struct partition_cpu, partition_cpus);
+static DEFINE_MUTEX(partition_lock);
+static struct cpumask parse_mask;
+static u64 frame;
+static int running;
+static const char window_owner[] = "partition";
+
+/* The window is worked out from the time rather than stepped through one at a
+ * time, so that if the clock jumps forward the windows it skipped are not each
+ * fired in turn */
+static enum hrtimer_restart partition_tick(struct hrtimer *timer)
+{
+	struct partition_cpu *c = container_of(timer, struct partition_cpu, timer);
+	u64 now = ktime_to_ns(hrtimer_cb_get_time(timer)), pos, next;
+	int i;
+
+	c->epoch = div64_u64(now, frame) * frame;
+	pos = now - c->epoch;
+
+	for(i = 0; i < c->nr_windows && c->windows[i].offset <= pos; i++)
+		;
+
+	/* Before the first window we are still in the last one of the frame
+	 * before */
+	chronos_set_window(c->cpu, c->windows[i ? i - 1 : c->nr_windows - 1].closed);
+
+	if(i == c->nr_windows)
+		next = c->epoch + frame + c->windows[0].offset;
+	else
+		next = c->epoch + c->windows[i].offset;
+
+	hrtimer_set_expires(timer, ns_to_ktime(next));
+
+	return HRTIMER_RESTART;
+}
+
+/* Runs on the CPU itself, so that the timer is pinned there */
+static void partition_start_cpu(void *data)
+{
+	struct partition_cpu *c = data;
+
+	hrtimer_start(&c->timer, ns_to_ktime(c->epoch + c->windows[0].offset),
+		      HRTIMER_MODE_ABS_PINNED);
+}
+
+/* A window closes every priority partitioned on its CPU that it does not open.
+ * Priorities are turned around into the kernel's order here. */
+static void partition_close_windows(struct partition_cpu *c)
+{
+	int i, prio;
+	DECLARE_BITMAP(managed, MAX_RT_PRIO);
+
+	bitmap_zero(managed, MAX_RT_PRIO);
+	for(i = 0; i < c->nr_windows; i++)
+		bitmap_or(managed, managed, c->windows[i].open, MAX_RT_PRIO);
+
+	for(i = 0; i < c->nr_windows; i++) {
+		bitmap_zero(c->windows[i].closed, MAX_RT_PRIO);
+		for_each_set_bit(prio, managed, MAX_RT_PRIO) {
+			if(!test_bit(prio, c->windows[i].open))
+				__set_bit(MAX_RT_PRIO - prio - 1, c->windows[i].closed);
+		}
+	}
+}
+
+static int partition_start(void)
+{
+	int cpu, ret;
+	u64 epoch;
+	struct partition_cpu *c;
+	struct timespec now;
+
+	ret = chronos_claim_window(window_owner);
+	if(ret)
+		return ret;
+
+	getnstimeofday(&now);
+	epoch = (div64_u64(timespec_to_ns(&now), frame) + 1) * frame;
+
+	for_each_online_cpu(cpu) {
+		c = &per_cpu(partition_cpus, cpu);
+		if(!c->nr_windows)
+			continue;
+
+		partition_close_windows(c);
+		c->epoch = epoch;
+		smp_call_function_single(cpu, partition_start_cpu, c, 1);
+	}
+
+	running = 1;
+	return 0;
+}
+
+/* Stop switching windows, open every partition again and throw the schedule
+ * away */
+static void partition_clear(void)
+{
+	int cpu;
+	struct partition_cpu *c;
+
+	for_each_possible_cpu(cpu) {
+		c = &per_cpu(partition_cpus, cpu);
+		if(!c->nr_windows)
+			continue;
+
+		hrtimer_cancel(&c->timer);
+		if(running && cpu_online(cpu))
+			chronos_set_window(cpu, NULL);
+		c->nr_windows = 0;
+	}
+
+	if(running)
+		chronos_release_window(window_owner);
+	running = 0;
+}
+
+static int partition_add_window(char *cpus, unsigned long offset_us, char *prios)
+{
+	int cpu, ret;
+	struct partition_cpu *c;
+	struct partition_window *w;
+	DECLARE_BITMAP(open, MAX_RT_PRIO);
+	u64 offset = (u64)offset_us * NSEC_PER_USEC;
+
+	if(running)
+		return -EBUSY;
+
+	if(!frame || offset >= frame)
+		return -EINVAL;
+
+	bitmap_zero(open, MAX_RT_PRIO);
+	if(strcmp(prios, "-")) {
+		ret = bitmap_parselist(prios, open, MAX_RT_PRIO);
+		if(ret)
+			return ret;
+	}
+
+	/* Closing it would starve the irq threads */
+	if(test_bit(MAX_USER_RT_PRIO / 2, open))
+		return -EINVAL;
+
+	ret = cpulist_parse(cpus, &parse_mask);
+	if(ret)
+		return ret;
+
+	if(cpumask_empty(&parse_mask) || !cpumask_subset(&parse_mask, cpu_online_mask))
+		return -EINVAL;
+
+	/* Check every CPU first, so that a bad line adds nothing */
+	for_each_cpu(cpu, &parse_mask) {
+		c = &per_cpu(partition_cpus, cpu);
+		if(c->nr_windows == PARTITION_MAX_WINDOWS)
+			return -ENOSPC;
+
+		if(c->nr_windows && offset <= c->windows[c->nr_windows - 1].offset)
+			return -EINVAL;
+	}
+
+	for_each_cpu(cpu, &parse_mask) {
+		c = &per_cpu(partition_cpus, cpu);
+		w = &c->windows[c->nr_windows++];
+		w->offset = offset;
+		bitmap_copy(w->open, open, MAX_RT_PRIO);
+	}
+
+	return 0;
+}
+
+static int partition_parse(char *line)
+{
+	char cpus[64], prios[128];
+	unsigned long us;
+
+	if(!*line)
+		return 0;
+
+	if(sscanf(line, "frame %lu", &us) == 1) {
+		partition_clear();
+		frame = (u64)us * NSEC_PER_USEC;
+		return 0;
+	}
+
+	if(!strcmp(line, "start")) {
+		if(running || !frame)
+			return -EINVAL;
+		return partition_start();
+	}
+
+	if(sscanf(line, "%63s %lu %127s", cpus, &us, prios) == 3)
+		return partition_add_window(cpus, us, prios);
+
+	return -EINVAL;
+}
+
+static ssize_t partition_write(struct file *filp, const char __user *ubuf,
+			       size_t count, loff_t *ppos)
+{
+	char *buf, *line, *pos;
+	int ret = 0;
+
+	if(count >= PAGE_SIZE)
+		return -EINVAL;
+
+	buf = kmalloc(count + 1, GFP_KERNEL);
+	if(!buf)
+		return -ENOMEM;
+
+	if(copy_from_user(buf, ubuf, count)) {
+		kfree(buf);
+		return -EFAULT;
+	}
+	buf[count] = '\0';
+
+	mutex_lock(&partition_lock);
+	pos = buf;
+	while(!ret && (line = strsep(&pos, "\n")) != NULL)
+		ret = partition_parse(strim(line));
+	mutex_unlock(&partition_lock);
+
+	kfree(buf);
+	return ret ? ret : count;
+}
+
+static int partition_show(struct seq_file *m, void *v)
+{
+	int cpu, i;
+	struct partition_cpu *c;
+	struct partition_window *w;
+
+	mutex_lock(&partition_lock);
+	seq_printf(m, "frame %llu\n", div_u64(frame, NSEC_PER_USEC));
+
+	for_each_possible_cpu(cpu) {
+		c = &per_cpu(partition_cpus, cpu);
+		for(i = 0; i < c->nr_windows; i++) {
+			w = &c->windows[i];
+			seq_printf(m, "%d %llu ", cpu, div_u64(w->offset, NSEC_PER_USEC));
+			if(bitmap_empty(w->open, MAX_RT_PRIO))
+				seq_printf(m, "-\n");
+			else {
+				seq_bitmap_list(m, w->open, MAX_RT_PRIO);
+				seq_putc(m, '\n');
+			}
+		}
+	}
+
+	seq_printf(m, "%s\n", running ? "running" : "stopped");
+	mutex_unlock(&partition_lock);
+
+	return 0;
+}
+
+static int partition_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, partition_show, NULL);
+}
+
+static const struct file_operations partition_fops = {
+	.owner		= THIS_MODULE,
+	.open		= partition_open,
+	.read		= seq_read,
+	.write		= partition_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init partition_init(void)
+{
+	int cpu;
+	struct partition_cpu *c;
+
+	for_each_possible_cpu(cpu) {
+		c = &per_cpu(partition_cpus, cpu);
+		hrtimer_init(&c->timer, CLOCK_REALTIME, HRTIMER_MODE_ABS);
+		c->timer.function = partition_tick;
+		c->timer.irqsafe = 1;
+		c->cpu = cpu;
+	}
+
+	if(!proc_create("chronos/partition", 0644, NULL, &partition_fops))
+		return -ENOMEM;
+
+	return 0;
+}
+module_init(partition_init);
+
+static void __exit partition_exit(void)
+{
+	remove_proc_entry("chronos/partition", NULL);
+
+	mutex_lock(&partition_lock);
+	partition_clear();
+	mutex_unlock(&partition_lock);
+}
+module_exit(partition_exit);
+
+MODULE_DESCRIPTION("Temporal Partitioning Module for ChronOS");
+MODULE_LICENSE("GPL");
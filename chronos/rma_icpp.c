@@ -3,13 +3,31 @@
 #include <linux/chronos_sched.h>
 #include <linux/chronos_util.h>
 #include <linux/list.h>
+#include <linux/rculist.h>
 
 struct list_head * get_current_task_mutex_list(pid_t tgid);
+struct list_head * get_shared_mutex_list(void);
+
+static void raise_floors(struct list_head *mutex_header_list)
+{
+	struct mutex_head *curr_mutex;
+
+	// Iterate through every mutex of the list.
+	list_for_each_entry_rcu(curr_mutex, mutex_header_list, list) {
+		// If the mutex has an owner.
+		if (curr_mutex->owner_t) {
+			// If the mutex's period_floor is lower than the period floor of the process.
+			if (compare_ts(&curr_mutex->period_floor, &curr_mutex->owner_t->period_floor)) {
+				// Lower the process' period floor to this new minimum period.
+				curr_mutex->owner_t->period_floor = curr_mutex->period_floor;
+			}
+		}
+	}
+}
 
 struct rt_info* sched_rma_icpp(struct list_head *head, int flags)
 {
 	struct rt_info *best_task = local_task(head->next), *curr_task;
-	struct mutex_head *curr_mutex;
 	struct list_head *mutex_header_list = get_current_task_mutex_list(task_of_rtinfo(best_task)->tgid);
 
 	// Iterate through every task in the local list.
@@ -18,19 +36,13 @@ struct rt_info* sched_rma_icpp(struct list_head *head, int flags)
 	}
 
 	// Check if there were any mutexes.
-	if (mutex_header_list) {
-		// Iterate through every mutex of the process.
-		list_for_each_entry(curr_mutex, mutex_header_list, list) {
-			// If the mutex has an owner.
-			if (curr_mutex->owner_t) {
-				// If the mutex's period_floor is lower than the period floor of the process.
-				if (compare_ts(&curr_mutex->period_floor, &curr_mutex->owner_t->period_floor)) {
-					// Lower the process' period floor to this new minimum period.
-					curr_mutex->owner_t->period_floor = curr_mutex->period_floor;
-				}
-			}
-		}
-	}
+	if (mutex_header_list)
+		raise_floors(mutex_header_list);
+
+	// Locks shared between processes can be held by tasks of any of them.
+	rcu_read_lock();
+	raise_floors(get_shared_mutex_list());
+	rcu_read_unlock();
 
 	// Iterate through every task in the local list.
 	list_for_each_entry(curr_task, head, task_list[LOCAL_LIST]) {
@@ -8,6 +8,8 @@ struct rt_info* sched_rma_ocpp(struct list_head *head, int flags)
 {
 	struct rt_info *best = local_task(head->next);
 
+	best = get_threshold_task(best, head);
+
 	if(flags & SCHED_FLAG_PI)
 		best = get_pi_task(best, head, flags);
 
@@ -0,0 +1,395 @@
+/* chronos/servers.c
+ *
+ * Hierarchical Server Scheduling Module for ChronOS
+ *
+ * Composes scheduling policies in two levels. Each child is the set of tasks
+ * at one ChronOS priority on a CPU, given a periodic server of budget Q every
+ * period P. On every CPU the servers are scheduled EDF, by the end of their
+ * current period, and the child of the running server is scheduled by its
+ * own local scheduler, or by the CPU's global domain if that is at the
+ * child's priority. Servers are loaded through /proc/chronos/servers:
+ *
+ *	<cpu> <prio> <budget us> <period us> <sched>	adds a server
+ *	start						starts the servers
+ *	clear						stops and removes them
+ *
+ * sched is the number of a local scheduler, as passed to set_scheduler, and
+ * the servers of a CPU must not add up to more than the whole CPU.
+ *
+ * Servers follow the periodic resource model: a server's budget is used up
+ * while it is the earliest deadline server with budget left, whether or not
+ * its child has anything to run, and is refilled at the start of each period.
+ * A child is thus guaranteed Q of every P regardless of what the others do,
+ * which is what lets each be analysed on its own. While a server does not run,
+ * its priority is closed on the CPU, as for a partition window (see
+ * chronos/partition.c; whichever is started first owns the windows, and the
+ * other gets -EBUSY). Each CPU has a pinned timer for the next budget
+ * exhaustion or replenishment. The scheduler of a CPU with servers cannot be
+ * changed until they are cleared.
+ *
+ * As with partitions, closing a priority closes it for every SCHED_FIFO task
+ * at it, not only the ChronOS ones, so servers must not share a priority with
+ * other real-time work. The priority irq threads run at, MAX_USER_RT_PRIO / 2,
+ * is refused.
+ *
+ * Copyright (C) 2009-2012 Virginia Tech Real Time Systems Lab
+ */
+
+#include <linux/bitmap.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/chronos_types.h>
+#include <linux/chronos_sched.h>
+#include <linux/chronos_util.h>
+
+#define SERVERS_MAX		16
+/* Utilizations are kept in parts per million */
+#define SERVER_UTIL_SCALE	MILLION
+
+struct server {
+	int prio;			/* ChronOS priority of the child */
+	u64 budget;			/* ns */
+	u64 period;			/* ns */
+	int sched;			/* its local scheduler */
+	/* Budget left, and the end of the current period */
+	u64 left;
+	u64 deadline;
+};
+
+struct server_cpu {
+	struct hrtimer timer;
+	int cpu;
+	int nr_servers;
+	long util;
+	/* The running server, and when it was last charged */
+	struct server *active;
+	u64 since;
+	DECLARE_BITMAP(closed, MAX_RT_PRIO);
+	struct server servers[SERVERS_MAX];
+};
+
+static DEFINE_PER_CPU(struct server_cpu, server_cpus);
+static DEFINE_MUTEX(servers_lock);
+static int running;
+static const char window_owner[] = "servers";
+
+static void charge_and_replenish(struct server_cpu *c, u64 now)
+{
+	int i;
+	struct server *s;
+
+	if(c->active) {
+		s = c->active;
+		s->left -= min(s->left, now - c->since);
+	}
+
+	for(i = 0; i < c->nr_servers; i++) {
+		s = &c->servers[i];
+		if(now >= s->deadline) {
+			s->left = s->budget;
+			s->deadline += s->period *
+				(div64_u64(now - s->deadline, s->period) + 1);
+		}
+	}
+
+	c->since = now;
+}
+
+/* EDF among the servers with budget left */
+static struct server * pick_server(struct server_cpu *c)
+{
+	int i;
+	struct server *s, *best = NULL;
+
+	for(i = 0; i < c->nr_servers; i++) {
+		s = &c->servers[i];
+		if(s->left && (!best || s->deadline < best->deadline))
+			best = s;
+	}
+
+	return best;
+}
+
+static enum hrtimer_restart server_tick(struct hrtimer *timer)
+{
+	struct server_cpu *c = container_of(timer, struct server_cpu, timer);
+	u64 now = ktime_to_ns(ktime_get()), next = 0;
+	struct server *s;
+	int i;
+
+	charge_and_replenish(c, now);
+	c->active = pick_server(c);
+
+	/* Close every child but the running one */
+	bitmap_zero(c->closed, MAX_RT_PRIO);
+	for(i = 0; i < c->nr_servers; i++) {
+		s = &c->servers[i];
+		if(s != c->active)
+			__set_bit(MAX_RT_PRIO - s->prio - 1, c->closed);
+		if(!next || s->deadline < next)
+			next = s->deadline;
+	}
+
+	if(c->active && now + c->active->left < next)
+		next = now + c->active->left;
+
+	chronos_set_window(c->cpu, c->closed);
+	hrtimer_set_expires(timer, ns_to_ktime(next));
+
+	return HRTIMER_RESTART;
+}
+
+/* Runs on the CPU itself, so that the timer is pinned there */
+static void servers_start_cpu(void *data)
+{
+	struct server_cpu *c = data;
+	u64 now = ktime_to_ns(ktime_get());
+	int i;
+
+	for(i = 0; i < c->nr_servers; i++) {
+		c->servers[i].left = c->servers[i].budget;
+		c->servers[i].deadline = now + c->servers[i].period;
+	}
+
+	c->active = NULL;
+	c->since = now;
+	hrtimer_start(&c->timer, ns_to_ktime(now), HRTIMER_MODE_ABS_PINNED);
+}
+
+static int servers_start(void)
+{
+	int cpu, ret;
+	struct server_cpu *c;
+
+	ret = chronos_claim_window(window_owner);
+	if(ret)
+		return ret;
+
+	for_each_online_cpu(cpu) {
+		c = &per_cpu(server_cpus, cpu);
+		if(c->nr_servers)
+			smp_call_function_single(cpu, servers_start_cpu, c, 1);
+	}
+
+	running = 1;
+	return 0;
+}
+
+/* Stop the servers, open every child again and hand it back to the CPU's
+ * local scheduler */
+static void servers_clear(void)
+{
+	int cpu, i;
+	struct server_cpu *c;
+
+	for_each_possible_cpu(cpu) {
+		c = &per_cpu(server_cpus, cpu);
+		if(!c->nr_servers)
+			continue;
+
+		hrtimer_cancel(&c->timer);
+		if(cpu_online(cpu)) {
+			if(running)
+				chronos_set_window(cpu, NULL);
+			for(i = 0; i < c->nr_servers; i++)
+				chronos_set_child_local(cpu, MAX_RT_PRIO - c->servers[i].prio - 1, NULL);
+		}
+
+		c->nr_servers = 0;
+		c->util = 0;
+		c->active = NULL;
+	}
+
+	if(running)
+		chronos_release_window(window_owner);
+	running = 0;
+}
+
+static int servers_add(int cpu, int prio, unsigned long budget_us,
+		       unsigned long period_us, int sched)
+{
+	struct server_cpu *c;
+	struct server *s;
+	struct rt_sched_local *l;
+	long util;
+	int i, ret;
+
+	if(running)
+		return -EBUSY;
+
+	if(cpu < 0 || cpu >= nr_cpu_ids || !cpu_online(cpu) || prio < 1 ||
+	   prio >= MAX_RT_PRIO || !budget_us || budget_us > period_us ||
+	   (sched & SCHED_GLOBAL_MASK))
+		return -EINVAL;
+
+	/* Closing it would starve the irq threads */
+	if(prio == MAX_USER_RT_PRIO / 2)
+		return -EINVAL;
+
+	l = get_local_scheduler(sched);
+	if(!l)
+		return -ENOENT;
+
+	c = &per_cpu(server_cpus, cpu);
+	if(c->nr_servers == SERVERS_MAX)
+		return -ENOSPC;
+
+	for(i = 0; i < c->nr_servers; i++) {
+		if(c->servers[i].prio == prio)
+			return -EEXIST;
+	}
+
+	/* EDF admission of the servers themselves */
+	util = (long)div_u64((u64)budget_us * SERVER_UTIL_SCALE, period_us);
+	if(c->util + util > SERVER_UTIL_SCALE)
+		return -EBUSY;
+
+	ret = chronos_set_child_local(cpu, MAX_RT_PRIO - prio - 1, l);
+	if(ret)
+		return ret;
+
+	s = &c->servers[c->nr_servers++];
+	s->prio = prio;
+	s->budget = (u64)budget_us * NSEC_PER_USEC;
+	s->period = (u64)period_us * NSEC_PER_USEC;
+	s->sched = sched;
+	c->util += util;
+
+	return 0;
+}
+
+static int servers_parse(char *line)
+{
+	int cpu, prio, sched;
+	unsigned long budget, period;
+
+	if(!*line)
+		return 0;
+
+	if(!strcmp(line, "start")) {
+		if(running)
+			return -EINVAL;
+		return servers_start();
+	}
+
+	if(!strcmp(line, "clear")) {
+		servers_clear();
+		return 0;
+	}
+
+	if(sscanf(line, "%d %d %lu %lu %i", &cpu, &prio, &budget, &period, &sched) == 5)
+		return servers_add(cpu, prio, budget, period, sched);
+
+	return -EINVAL;
+}
+
+static ssize_t servers_write(struct file *filp, const char __user *ubuf,
+			     size_t count, loff_t *ppos)
+{
+	char *buf, *line, *pos;
+	int ret = 0;
+
+	if(count >= PAGE_SIZE)
+		return -EINVAL;
+
+	buf = kmalloc(count + 1, GFP_KERNEL);
+	if(!buf)
+		return -ENOMEM;
+
+	if(copy_from_user(buf, ubuf, count)) {
+		kfree(buf);
+		return -EFAULT;
+	}
+	buf[count] = '\0';
+
+	mutex_lock(&servers_lock);
+	pos = buf;
+	while(!ret && (line = strsep(&pos, "\n")) != NULL)
+		ret = servers_parse(strim(line));
+	mutex_unlock(&servers_lock);
+
+	kfree(buf);
+	return ret ? ret : count;
+}
+
+static int servers_show(struct seq_file *m, void *v)
+{
+	int cpu, i;
+	struct server_cpu *c;
+	struct server *s;
+
+	mutex_lock(&servers_lock);
+
+	for_each_possible_cpu(cpu) {
+		c = &per_cpu(server_cpus, cpu);
+		for(i = 0; i < c->nr_servers; i++) {
+			s = &c->servers[i];
+			seq_printf(m, "%d %d %llu %llu %#x\n", cpu, s->prio,
+				   div_u64(s->budget, NSEC_PER_USEC),
+				   div_u64(s->period, NSEC_PER_USEC), s->sched);
+		}
+	}
+
+	seq_printf(m, "%s\n", running ? "running" : "stopped");
+	mutex_unlock(&servers_lock);
+
+	return 0;
+}
+
+static int servers_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, servers_show, NULL);
+}
+
+static const struct file_operations servers_fops = {
+	.owner		= THIS_MODULE,
+	.open		= servers_open,
+	.read		= seq_read,
+	.write		= servers_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init servers_init(void)
+{
+	int cpu;
+	struct server_cpu *c;
+
+	for_each_possible_cpu(cpu) {
+		c = &per_cpu(server_cpus, cpu);
+		hrtimer_init(&c->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+		c->timer.function = server_tick;
+		c->timer.irqsafe = 1;
+		c->cpu = cpu;
+	}
+
+	if(!proc_create("chronos/servers", 0644, NULL, &servers_fops))
+		return -ENOMEM;
+
+	return 0;
+}
+module_init(servers_init);
+
+static void __exit servers_exit(void)
+{
+	remove_proc_entry("chronos/servers", NULL);
+
+	mutex_lock(&servers_lock);
+	servers_clear();
+	mutex_unlock(&servers_lock);
+}
+module_exit(servers_exit);
+
+MODULE_DESCRIPTION("Hierarchical Server Scheduling Module for ChronOS");
+MODULE_LICENSE("GPL");
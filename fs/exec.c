@@ -38,6 +38,7 @@
 #include <linux/key.h>
 #include <linux/personality.h>
 #include <linux/binfmts.h>
+#include <linux/chronos_sched.h>
 #include <linux/utsname.h>
 #include <linux/pid_namespace.h>
 #include <linux/module.h>
@@ -1165,6 +1166,11 @@ void setup_new_exec(struct linux_binprm * bprm)
 			
 	flush_signal_handlers(current, 0);
 	flush_old_files(current->files);
+
+#ifdef CONFIG_CHRONOS
+	/* The control word belonged to the old image */
+	release_np_ctrl(&current->rtinfo);
+#endif
 }
 EXPORT_SYMBOL(setup_new_exec);
 
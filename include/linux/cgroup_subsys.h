@@ -64,3 +64,9 @@ SUBSYS(perf)
 #endif
 
 /* */
+
+#ifdef CONFIG_CGROUP_CHRONOS
+SUBSYS(chronos)
+#endif
+
+/* */
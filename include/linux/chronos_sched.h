@@ -12,6 +12,7 @@
 
 #ifdef CONFIG_CHRONOS
 
+#include <linux/ktime.h>
 #include <linux/list.h>
 #include <linux/chronos_util.h>
 #include <linux/chronos_types.h>
@@ -38,6 +39,9 @@ DECLARE_PER_CPU(mcs_node_t, global_sched_lock_node);
 DECLARE_PER_CPU(unsigned int, last_queue_event);
 
 extern struct rt_sched_local fifo;
+extern unsigned int sysctl_chronos_migration_penalty;
+extern unsigned int sysctl_chronos_tick_defer;
+extern unsigned int sysctl_chronos_np_budget_max;
 
 /* Need these defined here for cschedstat related stuff */
 extern struct list_head rt_sched_list;
@@ -46,6 +50,11 @@ extern struct list_head global_domain_list;
 extern rwlock_t global_domain_list_lock;
 
 void chronos_init_cpu(int cpu);
+void chronos_resched_cpu_at(int cpu, ktime_t expires);
+int chronos_claim_window(const char *owner);
+void chronos_release_window(const char *owner);
+void chronos_set_window(int cpu, const unsigned long *closed);
+int chronos_set_child_local(int cpu, int prio, struct rt_sched_local *l);
 
 /* All the prio functions can be called without knowing if we have a valid domain
  * such as in sched_setscheduler. Hence we check g.
@@ -89,7 +98,7 @@ static inline int in_global_list(struct rt_info *r)
 
 static inline void mark_for_global_insert(struct rt_info *r, struct global_sched_domain *g)
 {
-	if(g) {
+	if(g && !g->scheduler->arch->local_queues) {
 		atomic_inc(&g->tasks);
 		task_set_flag(r, INSERT_GLOBAL);
 	}
@@ -135,6 +144,40 @@ static inline void unlock_global_sched_lock(struct global_sched_domain *g)
 	mcs_unlock(&g->global_sched_lock, &per_cpu(global_sched_lock_node, raw_smp_processor_id()));
 }
 
+/* Begin and end a real-time segment from inside the kernel */
+int _begin_rt_seg(struct task_struct *p, struct rt_info *task,
+		  struct timespec *deadline, struct timespec *period,
+		  unsigned long exec_time, unsigned int max_util, int prio);
+void _end_rt_seg(struct task_struct *p, struct rt_info *task, int prio);
+void release_np_ctrl(struct rt_info *task);
+
+/* CPU places of semi-partitioned tasks, see kernel/chronos_sched.c */
+DECLARE_PER_CPU(atomic_long_t, chronos_cpu_reserved);
+void chronos_reserve_place(struct rt_info *r, int home, long home_util,
+			   int split, long split_util);
+void chronos_release_place(struct rt_info *r);
+void reap_shared_mutexes(void);
+
+/* Charge segments to the cgroup of their task, see kernel/chronos_cgroup.c */
+#ifdef CONFIG_CGROUP_CHRONOS
+int chronos_cgroup_begin(struct task_struct *p, struct rt_info *r,
+			 unsigned long exec_time, struct timespec *period,
+			 int *prio);
+void chronos_cgroup_end(struct rt_info *r);
+void chronos_cgroup_miss(struct task_struct *p);
+void chronos_cgroup_migrated(struct task_struct *p);
+#else
+static inline int chronos_cgroup_begin(struct task_struct *p, struct rt_info *r,
+				       unsigned long exec_time, struct timespec *period,
+				       int *prio)
+{
+	return 0;
+}
+static inline void chronos_cgroup_end(struct rt_info *r) { }
+static inline void chronos_cgroup_miss(struct task_struct *p) { }
+static inline void chronos_cgroup_migrated(struct task_struct *p) { }
+#endif
+
 /* Add a local real-time scheduler */
 int add_local_scheduler(struct rt_sched_local *scheduler);
 void remove_local_scheduler(struct rt_sched_local *scheduler);
@@ -155,7 +198,8 @@ struct rt_sched_global * get_global_scheduler(int scheduler);
  * has_global_tasks() returns whether the list is empty
  * global_tasks() returns the task count, which is more optimistic and includes
  *	tasks that may not yet have been added to the list. It can also be
- *	called on an invalid domain.
+ *	called on an invalid domain. Domains whose tasks stay on their CPUs'
+ *	queues do not count them, and may always have some on another CPU.
  */
 static inline int has_global_tasks(struct global_sched_domain *g)
 {
@@ -164,6 +208,9 @@ static inline int has_global_tasks(struct global_sched_domain *g)
 
 static inline int global_tasks(struct global_sched_domain *g)
 {
+	if(g && g->scheduler->arch->local_queues)
+		return 1;
+
 	return g ? atomic_read(&g->tasks) : 0;
 }
 
@@ -178,6 +225,9 @@ int task_pullable(struct rt_info *task, int cpu);
 struct global_sched_domain *create_global_domain(struct rt_sched_global *g, int prio);
 void add_global_domain(struct global_sched_domain *domain);
 void remove_global_domain(struct global_sched_domain *domain);
+void free_global_domain(struct global_sched_domain *domain);
+void _migrate_global_tasks(struct global_sched_domain *from,
+			   struct global_sched_domain *to, int cpu);
 void print_global_domain(struct global_sched_domain *domain, struct seq_file *m);
 void print_global_domains(struct seq_file *m);
 void cpu_init_global_domain(int cpu);
@@ -188,23 +238,33 @@ void build_list_array (struct rt_info **head, int cpus);
 /* Mapping functions */
 void generic_map_all_tasks(struct rt_info *best, struct global_sched_domain *g);
 void map_to_me(struct rt_info *best, struct global_sched_domain *g);
+void map_cpu_state_tasks(struct rt_info *best, struct global_sched_domain *g);
+void map_gang_tasks(struct rt_info *best, struct global_sched_domain *g);
 
 /* Architecture init functions */
 int init_concurrent(struct global_sched_domain *g, int block);
 int init_stw(struct global_sched_domain *g, int block);
+int init_steal(struct global_sched_domain *g, int block);
 
 /* Architecture release functions */
 void release_concurrent(struct global_sched_domain *g);
 void release_generic(struct global_sched_domain *g);
+void release_timed(struct global_sched_domain *g);
+void release_steal(struct global_sched_domain *g);
 #define release_stw release_generic
 
 struct rt_info * presched_stw_generic(struct list_head *head);
 struct rt_info * presched_concurrent_generic(struct list_head *head);
 struct rt_info * presched_abort_generic(struct list_head *head);
+struct rt_info * presched_steal(struct list_head *head);
 
 extern struct rt_sched_arch rt_sched_arch_concurrent;
 extern struct rt_sched_arch rt_sched_arch_stw;
 extern struct rt_sched_arch rt_sched_arch_stw_jd;
+extern struct rt_sched_arch rt_sched_arch_stw_partitioned;
+extern struct rt_sched_arch rt_sched_arch_timed;
+extern struct rt_sched_arch rt_sched_arch_stw_gang;
+extern struct rt_sched_arch rt_sched_arch_steal;
 
 #endif	/* CONFIG_CHRONOS */
 #endif
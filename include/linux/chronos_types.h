@@ -12,7 +12,11 @@
 #define _CHRONOS_TYPES_H
 
 #include <linux/mcslock.h>
+#include <linux/cpumask.h>
+#include <linux/futex.h>
+#include <linux/hrtimer.h>
 #include <linux/list.h>
+#include <linux/rcupdate.h>
 #include <linux/time.h>
 #include <asm/atomic.h>
 
@@ -23,6 +27,8 @@
 #define TASK_FLAG_HUA			0x02
 #define TASK_FLAG_SCHEDULED		0x04
 #define TASK_FLAG_DEADLOCKED		0x08
+#define TASK_FLAG_MARKED		0x10
+#define TASK_FLAG_GANG_DONE		0x20
 #define TASK_FLAG_INSERT_GLOBAL		0x80
 
 /* Task flag management */
@@ -49,8 +55,15 @@
 #define SCHED_RT_RMA_ICPP		0x04
 #define SCHED_RT_RMA_OCPP		0x05
 #define SCHED_RT_FIFO_RA		0x07
+#define SCHED_RT_CYCLIC			0x08
 #define SCHED_RT_GFIFO			0x80
 #define SCHED_RT_GRMA			0x81
+#define SCHED_RT_EDF_SP			0x82
+#define SCHED_RT_DP_WRAP		0x83
+#define SCHED_RT_GEDF_VD		0x84
+#define SCHED_RT_GCYCLIC		0x85
+#define SCHED_RT_GEDF_GANG		0x86
+#define SCHED_RT_GEDF_WS		0x87
 
 /* Scheduling Flags */
 /* PI == Priority Inheritance
@@ -86,11 +99,26 @@
 #define SORT_KEY_GVD			4
 #define SORT_KEY_TDEADLINE		5
 
+/* Criticality levels for mixed-criticality scheduling */
+#define CRIT_LO				0
+#define CRIT_HI				1
+#define CRIT_LEVELS			2
 
 /* Syscall multiplexing flags */
 #define RT_SEG_BEGIN			0
 #define RT_SEG_END			1
 #define RT_SEG_ADD_ABORT		2
+#define RT_SEG_SET_CRIT			3
+#define RT_SEG_SET_NP			4
+#define RT_SEG_SET_THRESHOLD		5
+#define RT_SEG_SET_GANG			6
+#define RT_SEG_SET_IRQ			7
+#define RT_SEG_GET_WCET			8
+
+/* Pass as the exec_time of RT_SEG_BEGIN to use the observed execution time
+ * of the task's past segments instead, taken at WCET_OBSERVED_PERMILLE */
+#define EXEC_TIME_OBSERVED		(~0UL)
+#define WCET_OBSERVED_PERMILLE		999
 
 /* ChronOS mutex definitions */
 #define CHRONOS_MUTEX_REQUEST		0
@@ -98,6 +126,16 @@
 #define CHRONOS_MUTEX_INIT		2
 #define CHRONOS_MUTEX_DESTROY		3
 
+/* Phase-fair reader-writer locks, on the same struct mutex_data */
+#define CHRONOS_RWLOCK_RDLOCK		4
+#define CHRONOS_RWLOCK_WRLOCK		5
+#define CHRONOS_RWLOCK_UNLOCK		6
+#define CHRONOS_RWLOCK_INIT		7
+#define CHRONOS_RWLOCK_DESTROY		8
+
+/* Or'd into any of the above for a lock in memory shared between processes */
+#define CHRONOS_MUTEX_SHARED		128
+
 /* States for must_block (used for STW scheduling) */
 
 /* This CPU has inserted or removed a task, so
@@ -123,6 +161,8 @@ struct mutex_data {
 	unsigned long id;
 };
 
+/* For reader-writer locks owner_t is the writer holding the lock, or else
+ * one of the readers */
 struct mutex_head {
 	struct list_head list;
 	struct rt_info *owner_t;
@@ -130,6 +170,19 @@ struct mutex_head {
 	// Stores the lowest period of tasks that lock this.
 	struct timespec period_floor;
 	unsigned long id;
+
+	/* Reader-writer locks only */
+	int rw;
+	int write_held;
+	struct timespec wperiod_floor;	/* lowest period of the writers */
+	struct list_head readers;	/* readers holding the lock */
+	struct list_head rwaiting;	/* readers waiting out a writer phase */
+	struct list_head wwaiting;	/* writers, in FIFO order */
+
+	/* Process-shared locks are found by the futex key of their value, and
+	 * freed after an RCU grace period */
+	union futex_key key;
+	struct rcu_head rcu;
 };
 
 struct abort_info {
@@ -138,6 +191,41 @@ struct abort_info {
 	int max_util;
 };
 
+/* The criticality of a segment, and its WCET at each level up to it */
+struct crit_info {
+	int level;
+	unsigned long exec_time[CRIT_LEVELS];	/* us */
+};
+
+/* Execution times of a task's past segments, as a histogram with
+ * 1 << WCET_SUB_SHIFT buckets for each power of two us, so that quantiles
+ * read from it are at most 25% above the real ones */
+#define WCET_SUB_SHIFT		2
+#define WCET_BUCKETS		128
+
+struct wcet_hist {
+	u64 samples;
+	unsigned long max;		/* us */
+	u32 count[WCET_BUCKETS];
+};
+
+/* Scheduling keys inherited from ChronOS tasks blocked on rt_mutexes the
+ * task holds, 0 for none. See __rt_mutex_adjust_chronos(). */
+struct pi_info {
+	struct timespec deadline;
+	struct timespec period;
+};
+
+/* Limited preemption control word. Userspace sets np while it is inside a
+ * non-preemptive region, and the kernel sets delayed if it held a preemption
+ * back, in which case userspace should yield when it leaves the region.
+ * USERSPACE SHARED
+ */
+struct np_ctrl {
+	u32 np;
+	u32 delayed;
+};
+
 /* Struct for passing parameters down to kernel
  * USERSPACE SHARED
  */
@@ -179,15 +267,21 @@ struct rt_info {
 	struct timespec temp_deadline;		/* monotonic time */
 	struct timespec period;			/* relative time */
 	struct timespec left;			/* relative time */
+	struct timespec preempt_threshold;	/* relative time, 0 for none */
 	unsigned long exec_time;		/* WCET, us */
 	unsigned int max_util;
 	long local_ivd;
 	long global_ivd;
 	unsigned int seg_start_us;
+	int migration_charged;		/* cross-node penalty, see charge_migration() */
 
 	/* Lock information */
 	struct mutex_head *requested_resource;
 	struct rt_info *dep;
+	struct pi_info piinfo;
+	/* Deadline of the last message received from an MQ_DEADLINE queue,
+	 * taken over by the next segment. 0 for none. */
+	struct timespec msg_deadline;
 
 	struct timespec period_floor;
 
@@ -196,6 +290,56 @@ struct rt_info {
 
 	/* Abort information */
 	struct abort_info abortinfo;
+	/* Fires when the segment fails, see chronos_deadline_timer() */
+	struct hrtimer deadline_timer;
+
+	/* Mixed-criticality information */
+	struct crit_info critinfo;
+	u64 seg_start_runtime;			/* ns of CPU time */
+
+	/* Online WCET profile, allocated at the first end_rt_seg */
+	struct wcet_hist *wcet;
+
+	/* Limited preemption: the control word shared with userspace, and the
+	 * longest a preemption may be held back for. Whether one is being held
+	 * back, and until when, is kept here where userspace cannot reset it. */
+	struct np_ctrl *np_ctrl;
+	struct page *np_page;
+	unsigned long np_budget;		/* us */
+	int np_deferred;
+	u64 np_until;				/* ns, CLOCK_MONOTONIC */
+
+	/* Semi-partitioned scheduling: the CPU a task is assigned to, and for
+	 * split tasks the budget it runs there before moving to split_cpu.
+	 * These persist across segments so that tasks stay put, and so does
+	 * the utilization they reserve on each CPU until the task exits. */
+	int home_cpu;
+	int split_cpu;
+	unsigned long split_budget;		/* us */
+	long home_util;				/* parts per million */
+	long split_util;
+
+	/* Gang scheduling: threads with the same non-zero gang_id are
+	 * dispatched together or not at all. Also persists across segments. */
+	unsigned long gang_id;
+
+	/* The irq whose threads inherit this task's deadline, -1 for none */
+	int waited_irq;
+
+	/* DP-WRAP: start of the slice this task was laid out in, and where its
+	 * budget starts on the wrapped line of that slice and how long it is,
+	 * all ns */
+	s64 dp_slice;
+	s64 dp_offset;
+	s64 dp_budget;
+
+	/* The cgroup the running segment is charged to, and its utilization
+	 * in parts per million. If the group moved the task to its CPUs, the
+	 * affinity it had before. */
+	struct cgroup_subsys_state *cg_css;
+	unsigned long cg_util;
+	int cg_affine;
+	cpumask_t cg_saved_cpus;
 };
 
 struct global_sched_domain {
@@ -215,17 +359,27 @@ struct global_sched_domain {
 	unsigned int queue_stamp;
 	/* Current task count */
 	atomic_t tasks;
+	/* Criticality mode, for mixed-criticality schedulers */
+	int crit_mode;
+	/* Current slice, for slice-based schedulers, CLOCK_REALTIME ns */
+	s64 slice_start;
+	s64 slice_end;
 	/* Global domain list - This is the least used item, so put it at the
 	 * end so that it will be the thing sticking over the end of the 
 	 * cacheline on x86_64 platforms - possibly not an issue
 	 * because of prefetching */
 	struct list_head list;
+	/* Frees the domain once no scheduler can still see it */
+	struct rcu_head rcu;
 } __attribute__ ((__aligned__(SMP_CACHE_BYTES)));
 
 struct rt_sched_arch {
 	int (*arch_init) (struct global_sched_domain *g, int block);
 	void (*arch_release) (struct global_sched_domain *g);
 	void (*map_tasks) (struct rt_info *head, struct global_sched_domain *g);
+	/* Tasks stay queued on their CPUs and are never put on the global
+	 * list, so the scheduler's schedule function is not needed */
+	int local_queues;
 };
 
 struct sched_base {
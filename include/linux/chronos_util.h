@@ -104,15 +104,33 @@ static inline int is_zero_ts(struct timespec *t1)
 		return 0;
 }
 
+/* The deadline and period a task is ordered by: its own, or those it has
+ * inherited through rt_mutex PI while they are more urgent */
+static inline struct timespec * pi_deadline(struct rt_info *r)
+{
+	if(!is_zero_ts(&r->piinfo.deadline) &&
+	   earlier_deadline(&r->piinfo.deadline, &r->deadline))
+		return &r->piinfo.deadline;
+	return &r->deadline;
+}
+
+static inline struct timespec * pi_period(struct rt_info *r)
+{
+	if(!is_zero_ts(&r->piinfo.period) &&
+	   lower_period(&r->piinfo.period, &r->period))
+		return &r->piinfo.period;
+	return &r->period;
+}
+
 void quicksort(struct rt_info *head, int i, int key, int before);
 int insert_on_list(struct rt_info *item, struct rt_info *list, int i, int key, int before);
+int compare_before(struct rt_info *t1, struct rt_info *t2, int key);
 void insert_on_local_queue(struct rt_info *item, struct list_head *list, int key);
 void insert_on_global_queue(struct rt_info *item, struct list_head *list, int key);
 
 /* Check a dependancy chain built on the fly for loops */
 inline int check_dependancy_chain(struct rt_info *start, struct rt_info *next);
 
-#define TASK_FLAG_MARKED 0x10
 /* Check a prebuilt list and flag every task in a deadlock */
 void mark_local_deadlocks(struct list_head *head);
 void mark_global_deadlocks(struct list_head *head);
@@ -127,20 +145,19 @@ inline struct mutex_head* get_requested_resource(const struct rt_info *task);
 struct rt_info *get_requested_mutex_owner(const struct rt_info *task);
 
 /* Convert between long and timespecs */
-inline void long_to_timespec(unsigned long l, struct timespec *tspec);
+void long_to_timespec(unsigned long l, struct timespec *tspec);
 
 /* Convert between long and timespecs */
-inline unsigned long timespec_to_long(const struct timespec *ts);
+unsigned long timespec_to_long(const struct timespec *ts);
 
 void set_task_aborting(pid_t pid);
 void clear_task_aborting(pid_t pid);
 
 void abort_thread(struct rt_info *r);
 
-/* Check if a task has failed. If so, it will be aborted.
- * Returns true if it is aborted or has previously been.
- */
-inline int check_task_failure(struct rt_info *task, int flags);
+/* Fail a task, running its abort handler if it has one and flags allow it.
+ * Called by chronos_deadline_timer() when the segment misses its deadline. */
+void handle_task_failure(struct rt_info *task, int flags);
 
 /* Check if a task has been aborted */
 static inline int check_task_aborted(struct rt_info *task)
@@ -156,6 +173,15 @@ static inline int check_task_abort_nohua(struct rt_info *task)
 
 long calc_left(struct rt_info *task);
 long update_left(struct rt_info *task);
+u64 seg_runtime(struct rt_info *task);
+u64 __seg_runtime(struct rt_info *task);
+
+/* Record the execution time of a finished segment, and read back the time in
+ * us that the given fraction, in thousandths, of segments have stayed within.
+ * wcet_quantile() returns 0 until something has been recorded. */
+void wcet_record(struct rt_info *task, unsigned long us);
+unsigned long wcet_quantile(struct rt_info *task, unsigned int permille);
+void wcet_free(struct rt_info *task);
 
 /*Calculate the inverse value density of a task
  *
@@ -181,6 +207,7 @@ long update_left(struct rt_info *task);
 long livd(struct rt_info *task, int calc_dep, int flags);
 
 struct rt_info* get_pi_task(struct rt_info* best, struct list_head *head, int flags);
+struct rt_info* get_threshold_task(struct rt_info* best, struct list_head *head);
 
 inline void initialize_lists(struct rt_info *task);
 inline void initialize_dep(struct rt_info *task);
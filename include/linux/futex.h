@@ -177,6 +177,9 @@ union futex_key {
 extern void exit_robust_list(struct task_struct *curr);
 extern void exit_pi_state_list(struct task_struct *curr);
 extern int futex_cmpxchg_enabled;
+extern int get_futex_key(u32 __user *uaddr, int fshared, union futex_key *key,
+			 int rw);
+extern void put_futex_key(union futex_key *key);
 #else
 static inline void exit_robust_list(struct task_struct *curr)
 {
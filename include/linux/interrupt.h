@@ -107,6 +107,7 @@ typedef irqreturn_t (*irq_handler_t)(int, void *);
  * @thread:	thread pointer for threaded interrupts
  * @thread_flags:	flags related to @thread
  * @thread_mask:	bitmask for keeping track of @thread activity
+ * @chronos_waiter:	ChronOS task whose deadline @thread inherits
  */
 struct irqaction {
 	irq_handler_t handler;
@@ -120,6 +121,9 @@ struct irqaction {
 	unsigned long thread_mask;
 	const char *name;
 	struct proc_dir_entry *dir;
+#ifdef CONFIG_CHRONOS
+	struct task_struct *chronos_waiter;
+#endif
 } ____cacheline_internodealigned_in_smp;
 
 extern irqreturn_t no_action(int cpl, void *dev_id);
@@ -142,6 +146,10 @@ request_any_context_irq(unsigned int irq, irq_handler_t handler,
 			unsigned long flags, const char *name, void *dev_id);
 
 extern void exit_irq_thread(void);
+#ifdef CONFIG_CHRONOS
+extern int irq_set_chronos_waiter(unsigned int irq, struct task_struct *p);
+extern void irq_drop_chronos_waiter(struct task_struct *p);
+#endif
 #else
 
 extern int __must_check
@@ -19,6 +19,9 @@
 #define _LINUX_MQUEUE_H
 
 #define MQ_PRIO_MAX 	32768
+/* mq_flags at creation: messages carry the sender's ChronOS deadline and are
+ * received earliest deadline first */
+#define MQ_DEADLINE	0x40000000
 /* per-uid limit of kernel memory used by mqueue, in bytes */
 #define MQ_BYTES_MAX	819200
 
@@ -73,6 +73,7 @@ struct msginfo {
 
 #ifdef __KERNEL__
 #include <linux/list.h>
+#include <linux/time.h>
 
 /* one msg_msg structure for each message */
 struct msg_msg {
@@ -81,6 +82,9 @@ struct msg_msg {
 	int m_ts;           /* message text size */
 	struct msg_msgseg* next;
 	void *security;
+#ifdef CONFIG_CHRONOS
+	struct timespec m_deadline;	/* sender's, on MQ_DEADLINE queues */
+#endif
 	/* the actual message follows immediately */
 };
 
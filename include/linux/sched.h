@@ -2104,6 +2104,10 @@ static inline void sched_autogroup_exit(struct signal_struct *sig) { }
 
 #ifdef CONFIG_RT_MUTEXES
 extern void task_setprio(struct task_struct *p, int prio);
+#ifdef CONFIG_CHRONOS
+extern void task_setpiinfo(struct task_struct *p, struct pi_info *pi);
+extern void task_inherit_deadline(struct task_struct *p, struct task_struct *from);
+#endif
 extern int rt_mutex_getprio(struct task_struct *p);
 static inline void rt_mutex_setprio(struct task_struct *p, int prio)
 {
@@ -2683,6 +2687,11 @@ extern void signal_wake_up(struct task_struct *t, int resume_stopped);
 
 #ifdef CONFIG_CHRONOS
 int prio_resched_cpu(int cpu, int prio);
+void chronos_resched_cpu(int cpu);
+int sched_chronos_single(int cpu);
+int chronos_cpu_in_segment(int cpu);
+unsigned long long chronos_task_runtime(struct task_struct *p);
+enum hrtimer_restart chronos_deadline_timer(struct hrtimer *timer);
 void inc_abort_count(struct task_struct *p);
 #endif
 
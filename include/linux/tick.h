@@ -67,6 +67,12 @@ struct tick_sched {
 	unsigned long			next_jiffies;
 	ktime_t				idle_expires;
 	int				do_timer_last;
+#ifdef CONFIG_CHRONOS
+	int				chronos_deferred;
+	int				chronos_user;
+	unsigned long			chronos_jiffies;
+	ktime_t				chronos_tick;
+#endif
 };
 
 extern void __init tick_init(void);
@@ -85,6 +91,10 @@ extern void tick_cancel_sched_timer(int cpu);
 static inline void tick_cancel_sched_timer(int cpu) { }
 # endif
 
+# ifdef CONFIG_CHRONOS
+extern void tick_chronos_restart(void);
+# endif
+
 # ifdef CONFIG_GENERIC_CLOCKEVENTS_BROADCAST
 extern struct tick_device *tick_get_broadcast_device(void);
 extern struct cpumask *tick_get_broadcast_mask(void);
@@ -227,6 +227,7 @@ struct sock_common {
   *	@sk_security: used by security modules
   *	@sk_mark: generic packet mark
   *	@sk_classid: this socket's cgroup classid
+  *	@sk_deadline: deadline of the ChronOS task which last sent on this socket
   *	@sk_write_pending: a write to stream socket waits to start
   *	@sk_state_change: callback to indicate change in the state of the sock
   *	@sk_data_ready: callback to indicate there is data to be processed
@@ -338,6 +339,9 @@ struct sock {
 #endif
 	__u32			sk_mark;
 	u32			sk_classid;
+#ifdef CONFIG_CHRONOS
+	struct timespec		sk_deadline;
+#endif
 	void			(*sk_state_change)(struct sock *sk);
 	void			(*sk_data_ready)(struct sock *sk, int bytes);
 	void			(*sk_write_space)(struct sock *sk);
@@ -1119,6 +1123,14 @@ static inline void sock_update_classid(struct sock *sk)
 }
 #endif
 
+#ifdef CONFIG_CHRONOS
+extern void sock_update_deadline(struct sock *sk);
+#else
+static inline void sock_update_deadline(struct sock *sk)
+{
+}
+#endif
+
 /*
  * Functions to fill in entries in struct proto_ops when a protocol
  * does not implement a particular function.
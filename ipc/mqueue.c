@@ -34,6 +34,10 @@
 #include <linux/ipc_namespace.h>
 #include <linux/slab.h>
 
+#ifdef CONFIG_CHRONOS
+#include <linux/chronos_util.h>
+#endif
+
 #include <net/sock.h>
 #include "util.h"
 
@@ -147,6 +151,9 @@ static struct inode *mqueue_get_inode(struct super_block *sb,
 		if (attr) {
 			info->attr.mq_maxmsg = attr->mq_maxmsg;
 			info->attr.mq_msgsize = attr->mq_msgsize;
+#ifdef CONFIG_CHRONOS
+			info->attr.mq_flags = attr->mq_flags & MQ_DEADLINE;
+#endif
 		}
 		mq_msg_tblsz = info->attr.mq_maxmsg * sizeof(struct msg_msg *);
 		info->messages = kmalloc(mq_msg_tblsz, GFP_KERNEL);
@@ -494,13 +501,77 @@ static struct ext_wait_queue *wq_get_first_waiter(
 	return list_entry(ptr, struct ext_wait_queue, list);
 }
 
+#ifdef CONFIG_CHRONOS
+/*
+ * On MQ_DEADLINE queues a message carries the deadline of the ChronOS task
+ * that sent it, and the task that receives it takes that deadline over for
+ * its next segment, so a pipeline runs by the deadline of the work it is
+ * passing along.
+ */
+static void msg_set_deadline(struct mqueue_inode_info *info,
+			     struct msg_msg *msg)
+{
+	if ((info->attr.mq_flags & MQ_DEADLINE) &&
+	    current->policy == SCHED_CHRONOS)
+		msg->m_deadline = *pi_deadline(&current->rtinfo);
+	else
+		zero_ts(&msg->m_deadline);
+}
+
+/* Only MQ_DEADLINE queues hand a deadline down, and a message without one
+ * leaves a deadline received earlier in place, as does a later one */
+static void msg_inherit_deadline(struct mqueue_inode_info *info,
+				 struct msg_msg *msg)
+{
+	struct timespec *d = &current->rtinfo.msg_deadline;
+
+	if (!(info->attr.mq_flags & MQ_DEADLINE) || is_zero_ts(&msg->m_deadline))
+		return;
+
+	if (is_zero_ts(d) || timespec_compare(&msg->m_deadline, d) < 0)
+		*d = msg->m_deadline;
+}
+
+/* Should a be received before b? Messages without a deadline come last. */
+static int msg_before(struct mqueue_inode_info *info, struct msg_msg *a,
+		      struct msg_msg *b)
+{
+	if ((info->attr.mq_flags & MQ_DEADLINE) &&
+	    !timespec_equal(&a->m_deadline, &b->m_deadline)) {
+		if (is_zero_ts(&a->m_deadline))
+			return 0;
+		if (is_zero_ts(&b->m_deadline))
+			return 1;
+		return timespec_compare(&a->m_deadline, &b->m_deadline) < 0;
+	}
+
+	return a->m_type > b->m_type;
+}
+#else
+static inline void msg_set_deadline(struct mqueue_inode_info *info,
+				    struct msg_msg *msg)
+{
+}
+
+static inline void msg_inherit_deadline(struct mqueue_inode_info *info,
+					struct msg_msg *msg)
+{
+}
+
+static inline int msg_before(struct mqueue_inode_info *info,
+			     struct msg_msg *a, struct msg_msg *b)
+{
+	return a->m_type > b->m_type;
+}
+#endif
+
 /* Auxiliary functions to manipulate messages' list */
 static void msg_insert(struct msg_msg *ptr, struct mqueue_inode_info *info)
 {
 	int k;
 
 	k = info->attr.mq_curmsgs - 1;
-	while (k >= 0 && info->messages[k]->m_type >= ptr->m_type) {
+	while (k >= 0 && !msg_before(info, ptr, info->messages[k])) {
 		info->messages[k + 1] = info->messages[k];
 		k--;
 	}
@@ -915,6 +986,7 @@ static inline void pipelined_receive(struct mqueue_inode_info *info)
 	}
 	msg_ptr->m_ts = msg_len;
 	msg_ptr->m_type = msg_prio;
+	msg_set_deadline(info, msg_ptr);
 
 	spin_lock(&info->lock);
 
@@ -1021,6 +1093,7 @@ SYSCALL_DEFINE5(mq_timedreceive, mqd_t, mqdes, char __user *, u_msg_ptr,
 	}
 	if (ret == 0) {
 		ret = msg_ptr->m_ts;
+		msg_inherit_deadline(info, msg_ptr);
 
 		if ((u_msg_prio && put_user(msg_ptr->m_type, u_msg_prio)) ||
 			store_msg(u_msg_ptr, msg_ptr, msg_ptr->m_ts)) {
@@ -1183,7 +1256,8 @@ SYSCALL_DEFINE3(mq_getsetattr, mqd_t, mqdes,
 	if (u_mqstat != NULL) {
 		if (copy_from_user(&mqstat, u_mqstat, sizeof(struct mq_attr)))
 			return -EFAULT;
-		if (mqstat.mq_flags & (~O_NONBLOCK))
+		/* MQ_DEADLINE is fixed at creation, but may be passed back */
+		if (mqstat.mq_flags & ~(O_NONBLOCK | MQ_DEADLINE))
 			return -EINVAL;
 	}
 
@@ -1203,7 +1277,7 @@ SYSCALL_DEFINE3(mq_getsetattr, mqd_t, mqdes,
 	spin_lock(&info->lock);
 
 	omqstat = info->attr;
-	omqstat.mq_flags = filp->f_flags & O_NONBLOCK;
+	omqstat.mq_flags = (filp->f_flags & O_NONBLOCK) | info->attr.mq_flags;
 	if (u_mqstat) {
 		audit_mq_getsetattr(mqdes, &mqstat);
 		spin_lock(&filp->f_lock);
@@ -0,0 +1,403 @@
+/* kernel/chronos_cgroup.c
+ *
+ * ChronOS cgroup controller
+ *
+ * Groups real-time applications so that they can be placed and capped without
+ * set_scheduler calls of their own. Each group other than the root has:
+ *
+ *	chronos.cpus		CPU list the group's segments run on
+ *	chronos.prio		ChronOS priority its segments run at, 0 to keep
+ *				the one passed to begin_rt_seg
+ *	chronos.scheduler	scheduler of the group's domain, as passed to
+ *				set_scheduler; writing it sets up the domain on
+ *				cpus at prio
+ *	chronos.util_max	cap on the utilization of the group's running
+ *				segments, in parts per million of a CPU, 0 for
+ *				none
+ *	chronos.util		utilization charged to the group
+ *	chronos.stats		segments begun, segments aborted, and migrations
+ *				between CPUs
+ *
+ * A segment is charged exec_time/period when it begins, or a whole CPU if it
+ * has no period, to its group and every ancestor, and begin_rt_seg fails with
+ * EBUSY if that would take any of them over its cap. The charge is given back
+ * when the segment ends or the task exits; a task moved while in a segment
+ * keeps charging its old group until then. A group with charged segments
+ * cannot be removed. A segment of a group with cpus runs on them, and the
+ * task gets back the affinity it had when the segment ends.
+ *
+ * Copyright (C) 2009-2012 Virginia Tech Real Time Systems Lab
+ */
+
+#include <linux/cgroup.h>
+#include <linux/cpumask.h>
+#include <linux/err.h>
+#include <linux/math64.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/chronos_types.h>
+#include <linux/chronos_sched.h>
+
+struct chronos_cgroup {
+	struct cgroup_subsys_state css;
+	cpumask_var_t cpus;
+	int prio;
+	int sched;
+	/* Utilizations, in parts per million of a CPU */
+	unsigned long util_max;
+	unsigned long util;
+	atomic_t segments;
+	atomic_t misses;
+	atomic_t migrations;
+};
+
+/* Protects util along the hierarchy, and the charges of tasks */
+static DEFINE_SPINLOCK(chronos_cgroup_lock);
+
+static inline struct chronos_cgroup *cgroup_chronos(struct cgroup *cgrp)
+{
+	return container_of(cgroup_subsys_state(cgrp, chronos_subsys_id),
+			    struct chronos_cgroup, css);
+}
+
+static inline struct chronos_cgroup *task_chronos(struct task_struct *p)
+{
+	return container_of(task_subsys_state(p, chronos_subsys_id),
+			    struct chronos_cgroup, css);
+}
+
+static inline struct chronos_cgroup *parent_chronos(struct chronos_cgroup *cc)
+{
+	struct cgroup *parent = cc->css.cgroup->parent;
+
+	return parent ? cgroup_chronos(parent) : NULL;
+}
+
+static void charge(struct chronos_cgroup *cc, long util)
+{
+	for(; cc; cc = parent_chronos(cc))
+		cc->util += util;
+}
+
+static int over_cap(struct chronos_cgroup *cc, unsigned long util)
+{
+	for(; cc; cc = parent_chronos(cc)) {
+		if(cc->util_max && cc->util + util > cc->util_max)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Give back the affinity a segment was begun with */
+static void restore_cpus(struct task_struct *p, struct rt_info *r)
+{
+	if(!r->cg_affine)
+		return;
+
+	r->cg_affine = 0;
+	if(!(p->flags & PF_EXITING))
+		set_cpus_allowed_ptr(p, &r->cg_saved_cpus);
+}
+
+/* Charge a segment about to begin to the group of p, and run it where the
+ * group says. A begin without an end replaces the segment, and its charge
+ * is only given back if the new one fits. */
+int chronos_cgroup_begin(struct task_struct *p, struct rt_info *r,
+			 unsigned long exec_time, struct timespec *period,
+			 int *prio)
+{
+	struct chronos_cgroup *cc, *old = NULL;
+	struct cgroup_subsys_state *old_css;
+	u64 period_us = div_u64(timespec_to_ns(period), NSEC_PER_USEC);
+	unsigned long util = MILLION, old_util;
+	int fits;
+
+	if(period_us)
+		util = min_t(u64, div64_u64((u64)exec_time * MILLION, period_us), MILLION);
+
+	rcu_read_lock();
+	cc = task_chronos(p);
+	css_get(&cc->css);
+	rcu_read_unlock();
+
+	/* Check against the caps with the old charge taken out */
+	spin_lock(&chronos_cgroup_lock);
+	old_css = r->cg_css;
+	old_util = r->cg_util;
+	if(old_css) {
+		old = container_of(old_css, struct chronos_cgroup, css);
+		charge(old, -(long)old_util);
+	}
+
+	fits = !over_cap(cc, util);
+	if(fits) {
+		charge(cc, util);
+		r->cg_css = &cc->css;
+		r->cg_util = util;
+	} else if(old)
+		charge(old, old_util);
+	spin_unlock(&chronos_cgroup_lock);
+
+	if(!fits) {
+		css_put(&cc->css);
+		return -EBUSY;
+	}
+
+	if(old_css)
+		css_put(old_css);
+
+	atomic_inc(&cc->segments);
+
+	if(cc->prio)
+		*prio = cc->prio;
+
+	if(cpumask_empty(cc->cpus))
+		restore_cpus(p, r);
+	else {
+		if(!r->cg_affine) {
+			cpumask_copy(&r->cg_saved_cpus, &p->cpus_allowed);
+			r->cg_affine = 1;
+		}
+		set_cpus_allowed_ptr(p, cc->cpus);
+	}
+
+	return 0;
+}
+
+/* Give back the charge of a segment, and the affinity it began with */
+void chronos_cgroup_end(struct rt_info *r)
+{
+	struct task_struct *p = container_of(r, struct task_struct, rtinfo);
+	struct cgroup_subsys_state *css;
+
+	spin_lock(&chronos_cgroup_lock);
+	css = r->cg_css;
+	if(css) {
+		charge(container_of(css, struct chronos_cgroup, css), -(long)r->cg_util);
+		r->cg_css = NULL;
+		r->cg_util = 0;
+	}
+	spin_unlock(&chronos_cgroup_lock);
+
+	if(css)
+		css_put(css);
+	restore_cpus(p, r);
+}
+
+/* Called with the runqueue locked */
+void chronos_cgroup_miss(struct task_struct *p)
+{
+	rcu_read_lock();
+	atomic_inc(&task_chronos(p)->misses);
+	rcu_read_unlock();
+}
+
+void chronos_cgroup_migrated(struct task_struct *p)
+{
+	rcu_read_lock();
+	atomic_inc(&task_chronos(p)->migrations);
+	rcu_read_unlock();
+}
+
+static struct cgroup_subsys_state *chronos_cgroup_create(struct cgroup_subsys *ss,
+							 struct cgroup *cgrp)
+{
+	struct chronos_cgroup *cc;
+
+	cc = kzalloc(sizeof(struct chronos_cgroup), GFP_KERNEL);
+	if(!cc)
+		return ERR_PTR(-ENOMEM);
+
+	if(!zalloc_cpumask_var(&cc->cpus, GFP_KERNEL)) {
+		kfree(cc);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	cc->sched = -1;
+	return &cc->css;
+}
+
+static void chronos_cgroup_destroy(struct cgroup_subsys *ss, struct cgroup *cgrp)
+{
+	struct chronos_cgroup *cc = cgroup_chronos(cgrp);
+
+	free_cpumask_var(cc->cpus);
+	kfree(cc);
+}
+
+static void chronos_cgroup_exit(struct cgroup_subsys *ss, struct cgroup *cgrp,
+				struct cgroup *old_cgrp, struct task_struct *task)
+{
+	chronos_cgroup_end(&task->rtinfo);
+}
+
+static int chronos_cpus_read(struct cgroup *cgrp, struct cftype *cft,
+			     struct seq_file *m)
+{
+	seq_cpumask_list(m, cgroup_chronos(cgrp)->cpus);
+	seq_putc(m, '\n');
+	return 0;
+}
+
+static int chronos_cpus_write(struct cgroup *cgrp, struct cftype *cft,
+			      const char *buf)
+{
+	struct chronos_cgroup *cc = cgroup_chronos(cgrp);
+	cpumask_var_t mask;
+	int ret;
+
+	if(!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	ret = cpulist_parse(buf, mask);
+	if(!ret && !cpumask_subset(mask, cpu_online_mask))
+		ret = -EINVAL;
+	if(ret)
+		goto out;
+
+	if(!cgroup_lock_live_group(cgrp)) {
+		ret = -ENODEV;
+		goto out;
+	}
+	cpumask_copy(cc->cpus, mask);
+	cgroup_unlock();
+
+out:
+	free_cpumask_var(mask);
+	return ret;
+}
+
+static u64 chronos_prio_read(struct cgroup *cgrp, struct cftype *cft)
+{
+	return cgroup_chronos(cgrp)->prio;
+}
+
+static int chronos_prio_write(struct cgroup *cgrp, struct cftype *cft, u64 val)
+{
+	if(val >= MAX_USER_RT_PRIO)
+		return -EINVAL;
+
+	cgroup_chronos(cgrp)->prio = val;
+	return 0;
+}
+
+static s64 chronos_sched_read(struct cgroup *cgrp, struct cftype *cft)
+{
+	return cgroup_chronos(cgrp)->sched;
+}
+
+/* As set_scheduler, for the group's CPUs and priority */
+static int chronos_sched_write(struct cgroup *cgrp, struct cftype *cft, s64 val)
+{
+	struct chronos_cgroup *cc = cgroup_chronos(cgrp);
+	int scheduler = (val >> 8) & 0xFF;
+	struct rt_sched_local *l = NULL;
+	struct rt_sched_global *g = NULL;
+	int ret;
+
+	if(val < 0 || cpumask_empty(cc->cpus) || (!cc->prio && (scheduler & SCHED_GLOBAL_MASK)))
+		return -EINVAL;
+
+	if(scheduler & SCHED_GLOBAL_MASK) {
+		g = get_global_scheduler(scheduler);
+		if(g)
+			l = get_local_scheduler(g->local);
+	} else
+		l = get_local_scheduler(scheduler);
+
+	if(!l)
+		return -ENOENT;
+
+	l->flags = val & SCHED_FLAGS_MASK;
+
+	/* Keep cpus from changing under the domain */
+	if(!cgroup_lock_live_group(cgrp))
+		return -ENODEV;
+	ret = set_scheduler_mask(l, g, cc->cpus, cc->prio);
+	if(!ret)
+		cc->sched = val;
+	cgroup_unlock();
+
+	return ret;
+}
+
+static u64 chronos_util_max_read(struct cgroup *cgrp, struct cftype *cft)
+{
+	return cgroup_chronos(cgrp)->util_max;
+}
+
+static int chronos_util_max_write(struct cgroup *cgrp, struct cftype *cft, u64 val)
+{
+	if(val > (u64)MILLION * num_possible_cpus())
+		return -EINVAL;
+
+	cgroup_chronos(cgrp)->util_max = val;
+	return 0;
+}
+
+static u64 chronos_util_read(struct cgroup *cgrp, struct cftype *cft)
+{
+	return cgroup_chronos(cgrp)->util;
+}
+
+static int chronos_stats_read(struct cgroup *cgrp, struct cftype *cft,
+			      struct cgroup_map_cb *cb)
+{
+	struct chronos_cgroup *cc = cgroup_chronos(cgrp);
+
+	cb->fill(cb, "segments", atomic_read(&cc->segments));
+	cb->fill(cb, "misses", atomic_read(&cc->misses));
+	cb->fill(cb, "migrations", atomic_read(&cc->migrations));
+	return 0;
+}
+
+static struct cftype files[] = {
+	{
+		.name = "cpus",
+		.read_seq_string = chronos_cpus_read,
+		.write_string = chronos_cpus_write,
+		.max_write_len = 256,
+	},
+	{
+		.name = "prio",
+		.read_u64 = chronos_prio_read,
+		.write_u64 = chronos_prio_write,
+	},
+	{
+		.name = "scheduler",
+		.read_s64 = chronos_sched_read,
+		.write_s64 = chronos_sched_write,
+	},
+	{
+		.name = "util_max",
+		.read_u64 = chronos_util_max_read,
+		.write_u64 = chronos_util_max_write,
+	},
+	{
+		.name = "util",
+		.read_u64 = chronos_util_read,
+	},
+	{
+		.name = "stats",
+		.read_map = chronos_stats_read,
+	},
+};
+
+static int chronos_cgroup_populate(struct cgroup_subsys *ss, struct cgroup *cgrp)
+{
+	if(!cgrp->parent)
+		return 0;
+	return cgroup_add_files(cgrp, ss, files, ARRAY_SIZE(files));
+}
+
+struct cgroup_subsys chronos_subsys = {
+	.name		= "chronos",
+	.create		= chronos_cgroup_create,
+	.destroy	= chronos_cgroup_destroy,
+	.populate	= chronos_cgroup_populate,
+	.exit		= chronos_cgroup_exit,
+	.subsys_id	= chronos_subsys_id,
+};
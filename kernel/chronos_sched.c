@@ -9,12 +9,16 @@
  * Copyright (C) 2009-2012 Virginia Tech Real Time Systems Lab
  */
 
+#include <linux/chronos_global.h>
 #include <linux/chronos_sched.h>
 #include <linux/chronos_types.h>
+#include <linux/hrtimer.h>
 #include <linux/mcslock.h>
 #include <linux/module.h>
 #include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/sysctl.h>
+#include <linux/topology.h>
 #include <asm/atomic.h>
 
 /* List of all the real-time scheduling algorithms in the system */
@@ -30,11 +34,141 @@ DEFINE_PER_CPU(mcs_node_t, global_sched_lock_node);
 /* The last queue state seen by this cpu */
 DEFINE_PER_CPU(unsigned int, last_queue_event);
 
+/* Execution time, in us, charged to a task each time it is pulled across NUMA
+ * nodes, to account for refilling its working set from remote memory. */
+unsigned int sysctl_chronos_migration_penalty = 0;
+
+/* The longest, in ms, a CPU running a single ChronOS task goes without a
+ * tick. 0 keeps the tick running. */
+unsigned int sysctl_chronos_tick_defer = 100;
+
+/* The longest, in us, a task may hold back a preemption from inside a
+ * non-preemptive region. Longer budgets are refused. */
+unsigned int sysctl_chronos_np_budget_max = 1000;
+
+#ifdef CONFIG_SYSCTL
+static int zero;
+
+static struct ctl_path chronos_sched_path[] = {
+	{ .procname = "chronos", },
+	{ }
+};
+
+static struct ctl_table chronos_sched_table[] = {
+	{
+		.procname       = "migration_penalty",
+		.data           = &sysctl_chronos_migration_penalty,
+		.maxlen         = sizeof(unsigned int),
+		.mode           = 0644,
+		.proc_handler   = proc_dointvec_minmax,
+		.extra1         = &zero,
+	},
+	{
+		.procname       = "tick_defer",
+		.data           = &sysctl_chronos_tick_defer,
+		.maxlen         = sizeof(unsigned int),
+		.mode           = 0644,
+		.proc_handler   = proc_dointvec_minmax,
+		.extra1         = &zero,
+	},
+	{
+		.procname       = "np_budget_max",
+		.data           = &sysctl_chronos_np_budget_max,
+		.maxlen         = sizeof(unsigned int),
+		.mode           = 0644,
+		.proc_handler   = proc_dointvec_minmax,
+		.extra1         = &zero,
+	},
+	{ }
+};
+
+static int __init chronos_sched_sysctl_init(void)
+{
+	if(!register_sysctl_paths(chronos_sched_path, chronos_sched_table))
+		return -ENOMEM;
+
+	return 0;
+}
+__initcall(chronos_sched_sysctl_init);
+#endif
+
+/* Timers for schedulers that want a CPU to schedule again at a given time */
+struct resched_timer {
+	struct hrtimer timer;
+	int cpu;
+};
+
+static DEFINE_PER_CPU(struct resched_timer, resched_timer);
+
+static enum hrtimer_restart resched_timer_fn(struct hrtimer *timer)
+{
+	struct resched_timer *t = container_of(timer, struct resched_timer, timer);
+
+	chronos_resched_cpu(t->cpu);
+	return HRTIMER_NORESTART;
+}
+
+/* Make cpu schedule globally at an absolute CLOCK_REALTIME time, replacing
+ * any earlier request for that cpu */
+void chronos_resched_cpu_at(int cpu, ktime_t expires)
+{
+	struct hrtimer *timer = &per_cpu(resched_timer, cpu).timer;
+
+	hrtimer_try_to_cancel(timer);
+	hrtimer_start(timer, expires, HRTIMER_MODE_ABS);
+}
+EXPORT_SYMBOL(chronos_resched_cpu_at);
+
+/* Utilization reserved on each CPU, in parts per million, by the tasks that
+ * semi-partitioned schedulers have placed there. A place outlives the segment
+ * and even the scheduler module, so it is given back here when the task exits. */
+DEFINE_PER_CPU(atomic_long_t, chronos_cpu_reserved);
+EXPORT_PER_CPU_SYMBOL(chronos_cpu_reserved);
+
+void chronos_reserve_place(struct rt_info *r, int home, long home_util,
+			   int split, long split_util)
+{
+	chronos_release_place(r);
+
+	r->home_cpu = home;
+	r->home_util = home_util;
+	atomic_long_add(home_util, &per_cpu(chronos_cpu_reserved, home));
+
+	if(split >= 0) {
+		r->split_cpu = split;
+		r->split_util = split_util;
+		atomic_long_add(split_util, &per_cpu(chronos_cpu_reserved, split));
+	}
+}
+EXPORT_SYMBOL(chronos_reserve_place);
+
+void chronos_release_place(struct rt_info *r)
+{
+	if(r->home_cpu >= 0)
+		atomic_long_sub(r->home_util, &per_cpu(chronos_cpu_reserved, r->home_cpu));
+	if(r->split_cpu >= 0)
+		atomic_long_sub(r->split_util, &per_cpu(chronos_cpu_reserved, r->split_cpu));
+
+	r->home_cpu = -1;
+	r->split_cpu = -1;
+	r->home_util = 0;
+	r->split_util = 0;
+	r->split_budget = 0;
+}
+EXPORT_SYMBOL(chronos_release_place);
+
 void chronos_init_cpu(int cpu)
 {
+	struct resched_timer *t = &per_cpu(resched_timer, cpu);
+
 	mcs_node_init(&per_cpu(global_sched_lock_node, cpu));
 	per_cpu(global_task, cpu) = NULL;
 	per_cpu(last_queue_event, cpu) = 0;
+
+	hrtimer_init(&t->timer, CLOCK_REALTIME, HRTIMER_MODE_ABS);
+	t->timer.function = resched_timer_fn;
+	t->timer.irqsafe = 1;
+	t->cpu = cpu;
 }
 
 /* FIFO, just so that by default we don't muck with Linux */
@@ -134,6 +268,7 @@ struct rt_sched_local * get_local_scheduler(int scheduler) {
 
 	return NULL;
 }
+EXPORT_SYMBOL(get_local_scheduler);
 
 struct rt_sched_global * get_global_scheduler(int scheduler) {
 	struct sched_base *base = get_scheduler(scheduler);
@@ -142,6 +277,7 @@ struct rt_sched_global * get_global_scheduler(int scheduler) {
 
 	return NULL;
 }
+EXPORT_SYMBOL(get_global_scheduler);
 
 /* Global task list management
  * test_* add and remove functions can be called without knowing the validity of
@@ -178,11 +314,15 @@ void check_global_insert(struct task_struct *p, struct global_sched_domain *g)
 	}
 }
 
+/* A mixed-criticality domain goes back to LO mode once it is idle */
 void _remove_task_global(struct rt_info *r, struct global_sched_domain *g)
 {
 	g->queue_stamp++;
 	list_del_init(&r->task_list[GLOBAL_LIST]);
 	atomic_dec(&g->tasks);
+
+	if(list_empty(&g->global_task_list))
+		g->crit_mode = CRIT_LO;
 }
 EXPORT_SYMBOL(_remove_task_global);
 
@@ -234,6 +374,9 @@ struct global_sched_domain *create_global_domain(struct rt_sched_global *g, int
 		domain->scheduler = g;
 		domain->prio = prio;
 		domain->queue_stamp = 1;
+		domain->crit_mode = CRIT_LO;
+		domain->slice_start = 0;
+		domain->slice_end = 0;
 	} else
 		printk("Failed creating global scheduling domain with %s\n", g->base.name);
 
@@ -255,6 +398,56 @@ void remove_global_domain(struct global_sched_domain *domain)
 	write_unlock(&global_domain_list_lock);
 }
 
+static void free_global_domain_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct global_sched_domain, rcu));
+}
+
+/* Remove a domain that no CPU uses anymore, and free it once every scheduler
+ * which may still have picked it up from a runqueue has finished */
+void free_global_domain(struct global_sched_domain *domain)
+{
+	remove_global_domain(domain);
+	call_rcu_sched(&domain->rcu, free_global_domain_rcu);
+}
+
+/* Move the global tasks queued on a CPU that is changing domains over to its
+ * new domain in one pass, so they are not stranded on the old list. Tasks
+ * the new domain does not schedule globally are left to the local scheduler.
+ * The task list of from must be locked.
+ */
+void _migrate_global_tasks(struct global_sched_domain *from,
+			   struct global_sched_domain *to, int cpu)
+{
+	struct rt_info *it, *n;
+	int moved = 0, keep = to && to->prio == from->prio;
+
+	if(keep)
+		raw_spin_lock(&to->global_task_list_lock);
+
+	list_for_each_entry_safe(it, n, &from->global_task_list, task_list[GLOBAL_LIST]) {
+		if(task_cpu(task_of_rtinfo(it)) != cpu)
+			continue;
+
+		list_del_init(&it->task_list[GLOBAL_LIST]);
+		if(keep)
+			insert_on_global_queue(it, &to->global_task_list,
+					       to->scheduler->base.sort_key);
+		moved++;
+	}
+
+	if(moved) {
+		atomic_sub(moved, &from->tasks);
+		from->queue_stamp++;
+	}
+
+	if(keep) {
+		atomic_add(moved, &to->tasks);
+		to->queue_stamp++;
+		raw_spin_unlock(&to->global_task_list_lock);
+	}
+}
+
 void cpu_init_global_domain(int cpu) {
 	per_cpu(last_queue_event, cpu) = 0;
 	per_cpu(global_task, cpu) = NULL;
@@ -391,26 +584,82 @@ out:
 	return best;
 }
 
+/* How far a task has to move to get from one CPU to another */
+#define MIGRATE_SMT		0
+#define MIGRATE_LLC		1
+#define MIGRATE_NODE		2
+#define MIGRATE_REMOTE		3
+
+static inline const struct cpumask *llc_mask(int cpu)
+{
+#ifdef CONFIG_SCHED_MC
+	return cpu_coregroup_mask(cpu);
+#else
+	return topology_thread_cpumask(cpu);
+#endif
+}
+
+static int migration_level(int from, int to)
+{
+	if(cpumask_test_cpu(to, topology_thread_cpumask(from)))
+		return MIGRATE_SMT;
+	if(cpumask_test_cpu(to, llc_mask(from)))
+		return MIGRATE_LLC;
+	if(cpu_to_node(from) == cpu_to_node(to))
+		return MIGRATE_NODE;
+	return MIGRATE_REMOTE;
+}
+
 /*
- * Return the first task in the list, or NULL if the list is empty.
+ * Return the CPU in the mask that is closest to the given CPU in the cache
+ * hierarchy, preferring idle CPUs among those equally close.
  */
-static struct task_struct * find_any_task(struct global_sched_domain *g,
-					  struct rt_info **head)
+static int find_closest_cpu(int from, cpumask_t *m)
+{
+	int cpu, level, best = -1, best_level = MIGRATE_REMOTE + 1, best_idle = 0;
+
+	for_each_cpu_mask(cpu, *m) {
+		level = migration_level(from, cpu);
+		if(level < best_level || (level == best_level && !best_idle && idle_cpu(cpu))) {
+			best = cpu;
+			best_level = level;
+			best_idle = idle_cpu(cpu);
+			if(level == MIGRATE_SMT && best_idle)
+				break;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * Take the first task in the list and map it to the closest free CPU.
+ * Returns 0 if the list is empty.
+ */
+static int map_closest_task(cpumask_t *m, struct rt_info **head)
 {
+	int cpu;
 	struct rt_info *curr = *head;
 
 	if(!curr)
-		return NULL;
-	
+		return 0;
+
 	*head = list_empty(&curr->task_list[SCHED_LIST1]) ? NULL : task_list_entry(curr->task_list[SCHED_LIST1].next, SCHED_LIST1);
 	list_remove(curr, SCHED_LIST1);
-	return task_of_rtinfo(curr);
+
+	cpu = find_closest_cpu(task_cpu(task_of_rtinfo(curr)), m);
+	cpumask_clear_cpu(cpu, m);
+	per_cpu(global_task, cpu) = task_of_rtinfo(curr);
+
+	return 1;
 }
 
 /* The default mapping function
  *
  * The goal is to assign m tasks to m cpus with the least migration possible.
  * This is used for algorithms like GEDF that just select the m best tasks.
+ * Tasks that cannot stay where they are go, best first, to the free CPU that
+ * is closest to where they last ran, so cross-node moves are a last resort.
  */
 void generic_map_all_tasks(struct rt_info *best, struct global_sched_domain *g)
 {
@@ -425,13 +674,106 @@ void generic_map_all_tasks(struct rt_info *best, struct global_sched_domain *g)
 		per_cpu(global_task, cpu) = find_best_task(cpu, g, &mask, &head);
 	}
 
-	/* For the CPUs for which a best task was not chosen,
-	   pick any task */
-	for_each_cpu_mask(cpu, mask) {
-		per_cpu(global_task, cpu) = find_any_task(g, &head);
+	/* Move the remaining tasks as short a distance as possible */
+	while(!cpumask_empty(&mask) && map_closest_task(&mask, &head));
+}
+
+/*
+ * For partitioned scheduling -- the scheduler has already picked a task for
+ * each CPU in the domain and left it in that CPU's chronos_cpu_state[] head
+ */
+void map_cpu_state_tasks(struct rt_info *best, struct global_sched_domain *g)
+{
+	int cpu;
+	struct rt_info *r;
+
+	for_each_cpu_mask(cpu, g->global_sched_mask) {
+		r = get_cpu_state(cpu)->head;
+		per_cpu(global_task, cpu) = r ? task_of_rtinfo(r) : NULL;
+	}
+}
+
+/* Count the members of r's gang in the list starting at head */
+static int gang_members(struct rt_info *r, struct rt_info *head)
+{
+	int count = 0;
+	struct rt_info *it = head;
+
+	do {
+		if(it->gang_id == r->gang_id)
+			count++;
+		it = task_list_entry(it->task_list[SCHED_LIST1].next, SCHED_LIST1);
+	} while(it != head);
+
+	return count;
+}
+
+static void add_gang_task(struct rt_info *r, struct rt_info **head)
+{
+	if(*head)
+		list_add_before(*head, r, SCHED_LIST2);
+	else {
+		INIT_LIST_HEAD(&r->task_list[SCHED_LIST2]);
+		*head = r;
 	}
 }
 
+/*
+ * For gang scheduling -- the scheduler passes every task, best first, on
+ * SCHED_LIST1. Tasks are taken in that order while there are CPUs left, but
+ * the runnable members of a gang are only taken if they all fit, and then all
+ * at once, so a gang is either dispatched whole or not at all. A gang with
+ * more runnable members than the domain has CPUs could never run like this,
+ * so its members are taken one by one instead.
+ */
+void map_gang_tasks(struct rt_info *best, struct global_sched_domain *g)
+{
+	int cpus = count_global_cpus(g), free = cpus, size;
+	struct rt_info *it, *member, *head = NULL;
+
+	if(!best)
+		goto out;
+
+	it = best;
+	do {
+		task_clear_flag(it, GANG_DONE);
+		it = task_list_entry(it->task_list[SCHED_LIST1].next, SCHED_LIST1);
+	} while(it != best);
+
+	it = best;
+	do {
+		if(task_check_flag(it, GANG_DONE))
+			goto next;
+
+		size = it->gang_id ? gang_members(it, best) : 1;
+		if(size == 1 || size > cpus) {
+			add_gang_task(it, &head);
+			free--;
+			goto next;
+		}
+
+		member = it;
+		do {
+			if(member->gang_id == it->gang_id) {
+				task_set_flag(member, GANG_DONE);
+				if(size <= free)
+					add_gang_task(member, &head);
+			}
+			member = task_list_entry(member->task_list[SCHED_LIST1].next, SCHED_LIST1);
+		} while(member != best);
+
+		if(size <= free)
+			free -= size;
+next:
+		it = task_list_entry(it->task_list[SCHED_LIST1].next, SCHED_LIST1);
+	} while(free && it != best);
+
+	if(head)
+		copy_list(head, SCHED_LIST2, SCHED_LIST1);
+out:
+	generic_map_all_tasks(head, g);
+}
+
 /*
  * For concurrent scheduling -- if the best task is not NULL,
  * map it to the current CPU
@@ -551,22 +893,39 @@ void release_generic(struct global_sched_domain *g)
 	unlock_global_task_list(g);
 }
 
+/*
+ * Timed scheduling release function -- no CPU is told to reschedule, the
+ * scheduler arms chronos_resched_cpu_at() for the times it needs them.
+ */
+void release_timed(struct global_sched_domain *g)
+{
+	unlock_global_task_list(g);
+}
+
+/*
+ * Work stealing release function -- never called, as init_steal() does all
+ * the work and takes no locks
+ */
+void release_steal(struct global_sched_domain *g)
+{
+}
+
 struct rt_info * presched_stw_generic(struct list_head *head)
 {
 	return NULL;
 }
 EXPORT_SYMBOL(presched_stw_generic);
 
+/* chronos_deadline_timer() puts failed tasks at the head of the queue */
 struct rt_info * presched_abort_generic(struct list_head *head)
 {
 	struct rt_info *it;
 
-	list_for_each_entry(it, head, task_list[LOCAL_LIST]) {
-		if(check_task_abort_nohua(it))
-			return it;
-	}
+	if(list_empty(head))
+		return NULL;
 
-	return NULL;
+	it = local_task(head->next);
+	return check_task_abort_nohua(it) ? it : NULL;
 }
 EXPORT_SYMBOL(presched_abort_generic);
 
@@ -605,3 +964,31 @@ struct rt_sched_arch rt_sched_arch_stw_jd = {
 };
 EXPORT_SYMBOL(rt_sched_arch_stw_jd);
 
+struct rt_sched_arch rt_sched_arch_stw_partitioned = {
+	.arch_init = init_stw_jd,
+	.arch_release = release_stw,
+	.map_tasks = map_cpu_state_tasks
+};
+EXPORT_SYMBOL(rt_sched_arch_stw_partitioned);
+
+struct rt_sched_arch rt_sched_arch_timed = {
+	.arch_init = init_concurrent,
+	.arch_release = release_timed,
+	.map_tasks = map_to_me
+};
+EXPORT_SYMBOL(rt_sched_arch_timed);
+
+struct rt_sched_arch rt_sched_arch_stw_gang = {
+	.arch_init = init_stw_jd,
+	.arch_release = release_stw,
+	.map_tasks = map_gang_tasks
+};
+EXPORT_SYMBOL(rt_sched_arch_stw_gang);
+
+struct rt_sched_arch rt_sched_arch_steal = {
+	.arch_init = init_steal,
+	.arch_release = release_steal,
+	.map_tasks = map_to_me,
+	.local_queues = 1
+};
+EXPORT_SYMBOL(rt_sched_arch_steal);
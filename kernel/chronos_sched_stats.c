@@ -73,6 +73,7 @@ void clear_chronos_stats(struct rq *rq) {
 	schedstat_set(rq->sched_ipi_sent, 0);
 	schedstat_set(rq->sched_ipi_received, 0);
 	schedstat_set(rq->sched_ipi_missed, 0);
+	schedstat_set(rq->sched_preempt_deferred, 0);
 	schedstat_set(rq->task_pulled_from, 0);
 	schedstat_set(rq->task_pulled_to, 0);
 	schedstat_set(rq->task_pull_failed, 0);
@@ -126,6 +127,7 @@ static void print_cpu_chronos(struct seq_file *m, int cpu)
 	P(sched_ipi_sent);
 	P(sched_ipi_received);
 	P(sched_ipi_missed);
+	P(sched_preempt_deferred);
 	P(task_pulled_from);
 	P(task_pulled_to);
 	P(task_pull_failed);
@@ -151,6 +153,8 @@ void print_global_domain(struct global_sched_domain *domain, struct seq_file *m)
 		sched->name, sched->id);
 	SEQ_printf(m, "  Priority:\t%d\n  Tasks:\t%d\n",
 		domain->prio, atomic_read(&domain->tasks));
+	SEQ_printf(m, "  Mode:\t\t%s\n",
+		domain->crit_mode == CRIT_HI ? "HI" : "LO");
 }
 
 void print_global_domains(struct seq_file *m)
@@ -12,6 +12,7 @@
 #include <linux/chronos_util.h>
 #include <linux/chronos_types.h>
 #include <linux/module.h>
+#include <linux/slab.h>
 
 int (*kernel_set_task_aborting) (pid_t pid);
 EXPORT_SYMBOL(kernel_set_task_aborting);
@@ -40,9 +41,9 @@ inline int compare_after(struct rt_info *t1, struct rt_info *t2, int key)
 {
 	switch(key) {
 		case SORT_KEY_DEADLINE:
-			return (earlier_deadline(&t1->deadline, &t2->deadline));
+			return (earlier_deadline(pi_deadline(t1), pi_deadline(t2)));
 		case SORT_KEY_PERIOD:
-			return (lower_period(&t1->period, &t2->period));
+			return (lower_period(pi_period(t1), pi_period(t2)));
 		case SORT_KEY_LVD:
 			return (t1->local_ivd < t2->local_ivd);
 		case SORT_KEY_GVD:
@@ -62,9 +63,9 @@ inline int compare_before(struct rt_info *t1, struct rt_info *t2, int key)
 {
 	switch(key) {
 		case SORT_KEY_DEADLINE:
-			return (earlier_deadline(&t1->deadline, &t2->deadline));
+			return (earlier_deadline(pi_deadline(t1), pi_deadline(t2)));
 		case SORT_KEY_PERIOD:
-			return (lower_period(&t1->period, &t2->period));
+			return (lower_period(pi_period(t1), pi_period(t2)));
 		case SORT_KEY_LVD:
 			return (t1->local_ivd <= t2->local_ivd);
 		case SORT_KEY_GVD:
@@ -162,7 +163,9 @@ void mark_global_deadlocks(struct list_head *head)
 	mark_deadlocks(head, 1);
 }
 
-/* Return the owner of a resource */
+/* Return the owner of a resource. For a reader-writer lock that is the writer
+ * holding it or, while readers hold it, one of them, which is who a task
+ * blocked on it has to wait for either way. */
 struct rt_info* get_mutex_owner(const struct mutex_head *m)
 {
 	return m->owner_t;
@@ -184,11 +187,12 @@ struct rt_info* get_requested_mutex_owner(const struct rt_info *task)
 }
 
 /* Convert between long and timespecs */
-inline void long_to_timespec(unsigned long l, struct timespec *tspec)
+void long_to_timespec(unsigned long l, struct timespec *tspec)
 {
 	tspec->tv_sec = l/MILLION;
 	tspec->tv_nsec = (l%MILLION)*THOUSAND;
 }
+EXPORT_SYMBOL(long_to_timespec);
 
 static unsigned int task_time(struct rt_info *task)
 {
@@ -198,10 +202,11 @@ static unsigned int task_time(struct rt_info *task)
 }
 
 /* Convert between long and timespecs */
-inline unsigned long timespec_to_long(const struct timespec *ts)
+unsigned long timespec_to_long(const struct timespec *ts)
 {
 	return ts->tv_sec*MILLION + ts->tv_nsec/THOUSAND;
 }
+EXPORT_SYMBOL(timespec_to_long);
 
 long calc_left(struct rt_info *task)
 {
@@ -212,6 +217,137 @@ long calc_left(struct rt_info *task)
 }
 EXPORT_SYMBOL(calc_left);
 
+/* CPU time a task has used in its current segment, in ns, including what has
+ * not been accounted since the last tick. seg_runtime() takes the task's
+ * runqueue lock, so schedulers use __seg_runtime(). */
+u64 seg_runtime(struct rt_info *task)
+{
+	struct task_struct *ts = container_of(task, struct task_struct, rtinfo);
+
+	return task_sched_runtime(ts) - task->seg_start_runtime;
+}
+EXPORT_SYMBOL(seg_runtime);
+
+u64 __seg_runtime(struct rt_info *task)
+{
+	struct task_struct *ts = container_of(task, struct task_struct, rtinfo);
+
+	return chronos_task_runtime(ts) - task->seg_start_runtime;
+}
+EXPORT_SYMBOL(__seg_runtime);
+
+/* Histogram bucket of an execution time in us. The first buckets hold one
+ * value each, after that every power of two is split evenly. */
+static int wcet_bucket(unsigned long us)
+{
+	int order, bucket;
+
+	if(us < (1 << WCET_SUB_SHIFT))
+		return us;
+
+	order = fls_long(us) - 1;
+	bucket = ((order - WCET_SUB_SHIFT + 1) << WCET_SUB_SHIFT) +
+		 ((us >> (order - WCET_SUB_SHIFT)) & ((1 << WCET_SUB_SHIFT) - 1));
+
+	return min(bucket, WCET_BUCKETS - 1);
+}
+
+/* Largest execution time that falls in a bucket */
+static unsigned long wcet_bucket_max(int bucket)
+{
+	int order, sub;
+
+	if(bucket < (1 << WCET_SUB_SHIFT))
+		return bucket;
+	if(bucket == WCET_BUCKETS - 1)
+		return ULONG_MAX;
+
+	order = (bucket >> WCET_SUB_SHIFT) + WCET_SUB_SHIFT - 1;
+	sub = bucket & ((1 << WCET_SUB_SHIFT) - 1);
+
+	return (((1UL << WCET_SUB_SHIFT) + sub + 1) << (order - WCET_SUB_SHIFT)) - 1;
+}
+
+/* The profile may be read and recorded by other threads, so it is only touched
+ * under task_lock(), which also keeps wcet_free() from racing them at exit */
+void wcet_record(struct rt_info *task, unsigned long us)
+{
+	struct task_struct *p = container_of(task, struct task_struct, rtinfo);
+	struct wcet_hist *h, *new = NULL;
+
+	if(!task->wcet) {
+		new = kzalloc(sizeof(*new), GFP_KERNEL);
+		if(!new)
+			return;
+	}
+
+	task_lock(p);
+	if(p->flags & PF_EXITING)
+		goto out;
+
+	if(!task->wcet) {
+		task->wcet = new;
+		new = NULL;
+	}
+
+	h = task->wcet;
+	h->count[wcet_bucket(us)]++;
+	h->samples++;
+	if(us > h->max)
+		h->max = us;
+out:
+	task_unlock(p);
+	kfree(new);
+}
+EXPORT_SYMBOL(wcet_record);
+
+static unsigned long __wcet_quantile(struct wcet_hist *h, unsigned int permille)
+{
+	u64 rank, seen = 0;
+	int bucket;
+
+	if(!h || !h->samples)
+		return 0;
+
+	if(permille >= THOUSAND)
+		return h->max;
+
+	rank = max_t(u64, div_u64(h->samples * permille + THOUSAND - 1, THOUSAND), 1);
+	for(bucket = 0; bucket < WCET_BUCKETS; bucket++) {
+		seen += h->count[bucket];
+		if(seen >= rank)
+			return min(wcet_bucket_max(bucket), h->max);
+	}
+
+	return h->max;
+}
+
+unsigned long wcet_quantile(struct rt_info *task, unsigned int permille)
+{
+	struct task_struct *p = container_of(task, struct task_struct, rtinfo);
+	unsigned long ret;
+
+	task_lock(p);
+	ret = __wcet_quantile(task->wcet, permille);
+	task_unlock(p);
+
+	return ret;
+}
+EXPORT_SYMBOL(wcet_quantile);
+
+void wcet_free(struct rt_info *task)
+{
+	struct task_struct *p = container_of(task, struct task_struct, rtinfo);
+	struct wcet_hist *h;
+
+	task_lock(p);
+	h = task->wcet;
+	task->wcet = NULL;
+	task_unlock(p);
+
+	kfree(h);
+}
+
 long update_left(struct rt_info *task)
 {
 	long left = 0;
@@ -247,7 +383,7 @@ static void abort_deadlock(struct rt_info *task)
  * four cases - we are or aren't using abort handlers, the task does or
  * does not have a handler
  */
-static void handle_task_failure(struct rt_info *task, int flags)
+void handle_task_failure(struct rt_info *task, int flags)
 {
 		if ((flags & SCHED_FLAG_HUA) && task_check_flag(task, HUA)) {
 			task->deadline.tv_sec = task->abortinfo.deadline.tv_sec;
@@ -260,30 +396,6 @@ static void handle_task_failure(struct rt_info *task, int flags)
 		abort_thread(task);
 }
 
-/* Check if a task has failed
- * All failure conditions should be added here
- * Eventually add other possible conditions here
- */
-static inline void check_failure_conditions(struct rt_info *task, int flags)
-{
-	struct timespec t1;
-
-	t1 = current_kernel_time();
-
-	if(earlier_deadline(&(task->deadline), &t1))
-		handle_task_failure(task, flags);
-}
-
-/* Returns true if the task is or has been aborted, and doesn't have a handler */
-inline int check_task_failure(struct rt_info *task, int flags)
-{
-	if(!check_task_aborted(task))
-		check_failure_conditions(task, flags);
-
-	return task->local_ivd == -1;
-}
-EXPORT_SYMBOL(check_task_failure);
-
 /* Signal a thread that you want it to abort via shared memory */
 void abort_thread(struct rt_info *r)
 {
@@ -372,6 +484,28 @@ struct rt_info* get_pi_task(struct rt_info* best, struct list_head *head, int fl
 }
 EXPORT_SYMBOL(get_pi_task);
 
+/* Preemption thresholds for schedulers whose queues are sorted by period: the
+ * task that was running keeps the CPU unless best has a shorter period than
+ * its threshold. Segments that have only just begun have not started running
+ * as far as this is concerned, so they don't get to hold on.
+ */
+struct rt_info* get_threshold_task(struct rt_info* best, struct list_head *head)
+{
+	struct rt_info *curr = &current->rtinfo;
+
+	if(current->policy != SCHED_CHRONOS || curr == best || curr->cpu == -1 ||
+	   is_zero_ts(&curr->preempt_threshold) ||
+	   list_empty(&curr->task_list[LOCAL_LIST]) ||
+	   current->prio != container_of(best, struct task_struct, rtinfo)->prio)
+		return best;
+
+	if(lower_period(&best->period, &curr->preempt_threshold))
+		return best;
+
+	return curr;
+}
+EXPORT_SYMBOL(get_threshold_task);
+
 inline void initialize_lists(struct rt_info *task)
 {
 	int i;
@@ -486,4 +620,5 @@ void trim_list(struct rt_info *head, int list, int items)
 	curr->task_list[list].next = &head->task_list[list];
 	head->task_list[list].prev = &curr->task_list[list];
 }
+EXPORT_SYMBOL(trim_list);
 
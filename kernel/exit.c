@@ -52,6 +52,7 @@
 #include <linux/hw_breakpoint.h>
 #include <linux/oom.h>
 #include <linux/chronos_sched.h>
+#include <linux/chronos_util.h>
 
 #include <asm/uaccess.h>
 #include <asm/unistd.h>
@@ -935,6 +936,10 @@ NORET_TYPE void do_exit(long code)
 	if (tsk->policy == SCHED_CHRONOS)
 #endif
 		exit_chronos(tsk);
+	hrtimer_cancel(&tsk->rtinfo.deadline_timer);
+	release_np_ctrl(&tsk->rtinfo);
+	chronos_release_place(&tsk->rtinfo);
+	irq_drop_chronos_waiter(tsk);
 #endif
 
 	/*
@@ -961,6 +966,10 @@ NORET_TYPE void do_exit(long code)
 	exit_irq_thread();
 
 	exit_signals(tsk);  /* sets PF_EXITING */
+#ifdef CONFIG_CHRONOS
+	/* After PF_EXITING, so that no other thread records into it again */
+	wcet_free(&tsk->rtinfo);
+#endif
 	/*
 	 * tsk->flags are checked in the futex code to protect against
 	 * an exiting task cleaning up the robust pi futexes.
@@ -994,6 +1003,10 @@ NORET_TYPE void do_exit(long code)
 	taskstats_exit(tsk, group_dead);
 
 	exit_mm(tsk);
+#ifdef CONFIG_CHRONOS
+	if (group_dead)
+		reap_shared_mutexes();
+#endif
 
 	if (group_dead)
 		acct_process();
@@ -1051,6 +1051,33 @@ static void rtinfo_init_task(struct task_struct *p)
 	INIT_LIST_HEAD(&p->rtinfo.task_list[LOCAL_LIST]);
 	INIT_LIST_HEAD(&p->rtinfo.task_list[GLOBAL_LIST]);
 	task_init_flags(&p->rtinfo);
+	p->rtinfo.home_cpu = -1;
+	p->rtinfo.split_cpu = -1;
+	p->rtinfo.split_budget = 0;
+	p->rtinfo.home_util = 0;
+	p->rtinfo.split_util = 0;
+	p->rtinfo.gang_id = 0;
+	p->rtinfo.waited_irq = -1;
+	hrtimer_init(&p->rtinfo.deadline_timer, CLOCK_REALTIME, HRTIMER_MODE_ABS);
+	p->rtinfo.deadline_timer.function = chronos_deadline_timer;
+	p->rtinfo.deadline_timer.irqsafe = 1;
+	memset(&p->rtinfo.critinfo, 0, sizeof(struct crit_info));
+	memset(&p->rtinfo.piinfo, 0, sizeof(struct pi_info));
+	p->rtinfo.msg_deadline.tv_sec = 0;
+	p->rtinfo.msg_deadline.tv_nsec = 0;
+	p->rtinfo.cg_css = NULL;
+	p->rtinfo.cg_util = 0;
+	p->rtinfo.cg_affine = 0;
+	p->rtinfo.migration_charged = 0;
+	p->rtinfo.dp_slice = 0;
+	p->rtinfo.dp_budget = 0;
+	p->rtinfo.wcet = NULL;
+	p->rtinfo.np_ctrl = NULL;
+	p->rtinfo.np_page = NULL;
+	p->rtinfo.np_budget = 0;
+	p->rtinfo.np_deferred = 0;
+	p->rtinfo.preempt_threshold.tv_sec = 0;
+	p->rtinfo.preempt_threshold.tv_nsec = 0;
 #endif
 }
 
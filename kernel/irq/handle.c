@@ -51,6 +51,26 @@ static void warn_no_thread(unsigned int irq, struct irqaction *action)
 	       "but no thread function available.", irq, action->name);
 }
 
+#ifdef CONFIG_CHRONOS
+/*
+ * A thread bound with irq_set_chronos_waiter() takes on the deadline and
+ * period of the task waiting for it before it is woken, so that it is queued
+ * by them.
+ */
+static void irq_thread_inherit(struct irqaction *action)
+{
+	struct task_struct *p = action->chronos_waiter;
+
+	if (!p || p->policy != SCHED_CHRONOS || (p->flags & PF_EXITING) ||
+	    action->thread->policy != SCHED_CHRONOS)
+		return;
+
+	task_inherit_deadline(action->thread, p);
+}
+#else
+static inline void irq_thread_inherit(struct irqaction *action) { }
+#endif
+
 static void irq_wake_thread(struct irq_desc *desc, struct irqaction *action)
 {
 	/*
@@ -110,6 +130,7 @@ static void irq_wake_thread(struct irq_desc *desc, struct irqaction *action)
 	 * threads_oneshot untouched and runs the thread another time.
 	 */
 	desc->threads_oneshot |= action->thread_mask;
+	irq_thread_inherit(action);
 	wake_up_process(action->thread);
 }
 
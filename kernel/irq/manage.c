@@ -832,6 +832,128 @@ static int irq_thread(void *data)
 	return 0;
 }
 
+#ifdef CONFIG_CHRONOS
+/*
+ * Bind the threads of @irq to @p, or unbind them if @p is NULL. If @match
+ * is set, only threads bound to @match are touched.
+ */
+static int __irq_set_chronos_waiter(unsigned int irq, struct task_struct *p,
+				    struct task_struct *match)
+{
+	struct irq_desc *desc = irq_to_desc(irq);
+	struct task_struct *thread, *old;
+	struct irqaction *action;
+	struct sched_param param;
+	unsigned long flags;
+	int i, n, ret = -EINVAL;
+
+	if (!desc)
+		return -EINVAL;
+
+	/*
+	 * Changing the scheduling of the threads can not be done under
+	 * desc->lock, so take one action at a time and hold on to its
+	 * thread while we change it.
+	 */
+	for (i = 0; ; i++) {
+		raw_spin_lock_irqsave(&desc->lock, flags);
+		action = desc->action;
+		for (n = 0; action && n < i; n++)
+			action = action->next;
+		if (!action) {
+			raw_spin_unlock_irqrestore(&desc->lock, flags);
+			break;
+		}
+
+		thread = action->thread;
+		if (!thread || (match && action->chronos_waiter != match)) {
+			raw_spin_unlock_irqrestore(&desc->lock, flags);
+			continue;
+		}
+
+		old = action->chronos_waiter;
+		if (p)
+			get_task_struct(p);
+		action->chronos_waiter = p;
+		get_task_struct(thread);
+		raw_spin_unlock_irqrestore(&desc->lock, flags);
+
+		if (p) {
+			thread->rtinfo.deadline = p->rtinfo.deadline;
+			thread->rtinfo.period = p->rtinfo.period;
+			param.sched_priority = p->rt_priority;
+			sched_setscheduler_nocheck(thread, SCHED_CHRONOS, &param);
+		} else {
+			param.sched_priority = MAX_USER_RT_PRIO/2;
+			sched_setscheduler_nocheck(thread, SCHED_FIFO, &param);
+		}
+		put_task_struct(thread);
+
+		/* The hard irq handler may still be looking at the old one */
+		if (old) {
+			synchronize_irq(irq);
+			put_task_struct(old);
+		}
+		ret = 0;
+	}
+
+	return ret;
+}
+
+/**
+ *	irq_set_chronos_waiter - let the threads of an irq inherit a deadline
+ *	@irq: Interrupt line
+ *	@p: SCHED_CHRONOS task waiting on the device, NULL to unbind
+ *
+ *	While bound, the threads of @irq are SCHED_CHRONOS at the priority
+ *	of @p and take its deadline and period each time they are woken, so
+ *	they are ordered together with the segment that waits for them
+ *	rather than at a fixed SCHED_FIFO priority. The binding is dropped
+ *	when the segment of @p ends or @p exits. Needs CAP_SYS_NICE, as
+ *	changing the policy of any other task does.
+ */
+int irq_set_chronos_waiter(unsigned int irq, struct task_struct *p)
+{
+	struct rt_info *r;
+	int ret;
+
+	if (!capable(CAP_SYS_NICE))
+		return -EPERM;
+
+	if (!p)
+		return __irq_set_chronos_waiter(irq, NULL, NULL);
+
+	if (p->policy != SCHED_CHRONOS)
+		return -EINVAL;
+
+	r = &p->rtinfo;
+	if (r->waited_irq >= 0 && r->waited_irq != irq)
+		irq_drop_chronos_waiter(p);
+
+	ret = __irq_set_chronos_waiter(irq, p, NULL);
+	if (!ret)
+		r->waited_irq = irq;
+	return ret;
+}
+
+/**
+ *	irq_drop_chronos_waiter - unbind the irq threads bound to a task
+ *	@p: task whose segment ended or which is exiting
+ *
+ *	Threads since bound to another task are left alone.
+ */
+void irq_drop_chronos_waiter(struct task_struct *p)
+{
+	int irq = p->rtinfo.waited_irq;
+
+	if (irq < 0)
+		return;
+
+	p->rtinfo.waited_irq = -1;
+	__irq_set_chronos_waiter(irq, NULL, p);
+}
+#endif
+
 /*
  * Called from do_exit()
  */
@@ -1250,6 +1372,10 @@ static struct irqaction *__free_irq(unsigned int irq, void *dev_id)
 			kthread_stop(action->thread);
 		put_task_struct(action->thread);
 	}
+#ifdef CONFIG_CHRONOS
+	if (action->chronos_waiter)
+		put_task_struct(action->chronos_waiter);
+#endif
 
 	return action;
 }
@@ -20,6 +20,9 @@
 #include <linux/module.h>
 #include <linux/sched.h>
 #include <linux/timer.h>
+#ifdef CONFIG_CHRONOS
+#include <linux/chronos_util.h>
+#endif
 
 #include "rtmutex_common.h"
 
@@ -123,6 +126,91 @@ int rt_mutex_getprio(struct task_struct *task)
 		   task->normal_prio);
 }
 
+#ifdef CONFIG_CHRONOS
+/*
+ * ChronOS tasks are ordered by deadline or period rather than by prio, and
+ * usually all share one prio, so the prio boost alone does nothing for them.
+ * Each lock keeps the most urgent keys of its ChronOS waiters on its top
+ * waiter, and a ChronOS owner inherits the most urgent keys found on the
+ * top waiters of the locks it holds.
+ */
+static inline int rt_mutex_chronos_task(struct task_struct *task)
+{
+	return task->policy == SCHED_CHRONOS;
+}
+
+static void pi_info_merge(struct pi_info *pi, struct timespec *deadline,
+			  struct timespec *period)
+{
+	if (!is_zero_ts(deadline) && (is_zero_ts(&pi->deadline) ||
+				      earlier_deadline(deadline, &pi->deadline)))
+		pi->deadline = *deadline;
+	if (!is_zero_ts(period) && (is_zero_ts(&pi->period) ||
+				    lower_period(period, &pi->period)))
+		pi->period = *period;
+}
+
+/*
+ * Recalculate the keys kept on the top waiter of lock.
+ *
+ * Must be called with lock->wait_lock held.
+ */
+static void rt_mutex_update_piinfo(struct rt_mutex *lock)
+{
+	struct rt_mutex_waiter *waiter;
+	struct rt_info *r;
+	struct pi_info pi;
+
+	if (!rt_mutex_has_waiters(lock))
+		return;
+
+	memset(&pi, 0, sizeof(pi));
+	plist_for_each_entry(waiter, &lock->wait_list, list_entry) {
+		if (!rt_mutex_chronos_task(waiter->task))
+			continue;
+		r = &waiter->task->rtinfo;
+		pi_info_merge(&pi, pi_deadline(r), pi_period(r));
+	}
+
+	rt_mutex_top_waiter(lock)->piinfo = pi;
+}
+
+/*
+ * Adjust the inherited keys of a task, after its pi_waiters got modified.
+ * Returns 1 if they changed. task->pi_lock must be held.
+ */
+static int __rt_mutex_adjust_chronos(struct task_struct *task)
+{
+	struct rt_mutex_waiter *waiter;
+	struct pi_info pi;
+
+	memset(&pi, 0, sizeof(pi));
+	if (rt_mutex_chronos_task(task)) {
+		plist_for_each_entry(waiter, &task->pi_waiters, pi_list_entry)
+			pi_info_merge(&pi, &waiter->piinfo.deadline,
+				      &waiter->piinfo.period);
+	}
+
+	if (!memcmp(&pi, &task->rtinfo.piinfo, sizeof(pi)))
+		return 0;
+
+	task_setpiinfo(task, &pi);
+	return 1;
+}
+#else
+static inline int rt_mutex_chronos_task(struct task_struct *task)
+{
+	return 0;
+}
+
+static inline void rt_mutex_update_piinfo(struct rt_mutex *lock) { }
+
+static inline int __rt_mutex_adjust_chronos(struct task_struct *task)
+{
+	return 0;
+}
+#endif
+
 /*
  * Adjust the priority of a task, after its pi_waiters got modified.
  *
@@ -134,6 +222,8 @@ static void __rt_mutex_adjust_prio(struct task_struct *task)
 
 	if (task->prio != prio)
 		rt_mutex_setprio(task, prio);
+
+	__rt_mutex_adjust_chronos(task);
 }
 
 /*
@@ -180,7 +270,7 @@ static int rt_mutex_adjust_prio_chain(struct task_struct *task,
 {
 	struct rt_mutex *lock;
 	struct rt_mutex_waiter *waiter, *top_waiter = orig_waiter;
-	int detect_deadlock, ret = 0, depth = 0;
+	int detect_deadlock, ret = 0, depth = 0, chronos_changed;
 	unsigned long flags;
 
 	detect_deadlock = debug_rt_mutex_detect_deadlock(orig_waiter,
@@ -238,14 +328,17 @@ static int rt_mutex_adjust_prio_chain(struct task_struct *task,
 	 * mode!
 	 */
 	if (top_waiter && (!task_has_pi_waiters(task) ||
-			   top_waiter != task_top_pi_waiter(task)))
+			   (top_waiter != task_top_pi_waiter(task) &&
+			    !rt_mutex_chronos_task(task))))
 		goto out_unlock_pi;
 
 	/*
 	 * When deadlock detection is off then we check, if further
-	 * priority adjustment is necessary.
+	 * priority adjustment is necessary. ChronOS keys can change
+	 * without the prio doing so.
 	 */
-	if (!detect_deadlock && waiter->list_entry.prio == task->prio)
+	if (!detect_deadlock && waiter->list_entry.prio == task->prio &&
+	    !rt_mutex_chronos_task(task))
 		goto out_unlock_pi;
 
 	lock = waiter->lock;
@@ -269,6 +362,7 @@ static int rt_mutex_adjust_prio_chain(struct task_struct *task,
 	plist_del(&waiter->list_entry, &lock->wait_list);
 	waiter->list_entry.prio = task->prio;
 	plist_add(&waiter->list_entry, &lock->wait_list);
+	rt_mutex_update_piinfo(lock);
 
 	/* Release the task */
 	raw_spin_unlock_irqrestore(&task->pi_lock, flags);
@@ -291,6 +385,7 @@ static int rt_mutex_adjust_prio_chain(struct task_struct *task,
 	task = rt_mutex_owner(lock);
 	get_task_struct(task);
 	raw_spin_lock_irqsave(&task->pi_lock, flags);
+	chronos_changed = 0;
 
 	if (waiter == rt_mutex_top_waiter(lock)) {
 		/* Boost the owner */
@@ -306,6 +401,10 @@ static int rt_mutex_adjust_prio_chain(struct task_struct *task,
 		waiter->pi_list_entry.prio = waiter->list_entry.prio;
 		plist_add(&waiter->pi_list_entry, &task->pi_waiters);
 		__rt_mutex_adjust_prio(task);
+
+	} else if (rt_mutex_chronos_task(waiter->task)) {
+		/* Only the keys of the lock may have changed */
+		chronos_changed = __rt_mutex_adjust_chronos(task);
 	}
 
 	raw_spin_unlock_irqrestore(&task->pi_lock, flags);
@@ -313,7 +412,7 @@ static int rt_mutex_adjust_prio_chain(struct task_struct *task,
 	top_waiter = rt_mutex_top_waiter(lock);
 	raw_spin_unlock(&lock->wait_lock);
 
-	if (!detect_deadlock && waiter != top_waiter)
+	if (!detect_deadlock && waiter != top_waiter && !chronos_changed)
 		goto out_put_task;
 
 	goto again;
@@ -414,9 +513,11 @@ __try_to_take_rt_mutex(struct rt_mutex *lock, struct task_struct *task,
 		 * task->pi_waiters list.
 		 */
 		if (rt_mutex_has_waiters(lock)) {
+			rt_mutex_update_piinfo(lock);
 			top = rt_mutex_top_waiter(lock);
 			top->pi_list_entry.prio = top->list_entry.prio;
 			plist_add(&top->pi_list_entry, &task->pi_waiters);
+			__rt_mutex_adjust_chronos(task);
 		}
 		raw_spin_unlock_irqrestore(&task->pi_lock, flags);
 	}
@@ -482,6 +583,7 @@ static int task_blocks_on_rt_mutex(struct rt_mutex *lock,
 	if (rt_mutex_has_waiters(lock))
 		top_waiter = rt_mutex_top_waiter(lock);
 	plist_add(&waiter->list_entry, &lock->wait_list);
+	rt_mutex_update_piinfo(lock);
 
 	task->pi_blocked_on = waiter;
 
@@ -500,6 +602,14 @@ static int task_blocks_on_rt_mutex(struct rt_mutex *lock,
 			chain_walk = 1;
 		raw_spin_unlock_irqrestore(&owner->pi_lock, flags);
 	}
+	else if (rt_mutex_chronos_task(task)) {
+		/* Not the top waiter, but it may still have the earliest key */
+		raw_spin_lock_irqsave(&owner->pi_lock, flags);
+		if (__rt_mutex_adjust_chronos(owner) &&
+		    rt_mutex_real_waiter(owner->pi_blocked_on))
+			chain_walk = 1;
+		raw_spin_unlock_irqrestore(&owner->pi_lock, flags);
+	}
 	else if (debug_rt_mutex_detect_deadlock(waiter, detect_deadlock))
 		chain_walk = 1;
 
@@ -572,6 +682,7 @@ static void remove_waiter(struct rt_mutex *lock,
 	plist_del(&waiter->list_entry, &lock->wait_list);
 	current->pi_blocked_on = NULL;
 	raw_spin_unlock_irqrestore(&current->pi_lock, flags);
+	rt_mutex_update_piinfo(lock);
 
 	if (!owner)
 		return;
@@ -594,6 +705,16 @@ static void remove_waiter(struct rt_mutex *lock,
 			chain_walk = 1;
 
 		raw_spin_unlock_irqrestore(&owner->pi_lock, flags);
+
+	} else if (rt_mutex_chronos_task(current)) {
+
+		raw_spin_lock_irqsave(&owner->pi_lock, flags);
+
+		if (__rt_mutex_adjust_chronos(owner) &&
+		    rt_mutex_real_waiter(owner->pi_blocked_on))
+			chain_walk = 1;
+
+		raw_spin_unlock_irqrestore(&owner->pi_lock, flags);
 	}
 
 	WARN_ON(!plist_node_empty(&waiter->pi_list_entry));
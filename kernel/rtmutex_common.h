@@ -50,6 +50,10 @@ struct rt_mutex_waiter {
 	struct task_struct	*task;
 	struct rt_mutex		*lock;
 	bool			savestate;
+#ifdef CONFIG_CHRONOS
+	/* Most urgent ChronOS keys among all waiters, valid on the top waiter */
+	struct pi_info		piinfo;
+#endif
 #ifdef CONFIG_DEBUG_RT_MUTEXES
 	unsigned long		ip;
 	struct pid		*deadlock_task_pid;
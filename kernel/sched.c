@@ -388,6 +388,8 @@ struct rt_rq {
 	unsigned long rt_nr_running;
 #ifdef CONFIG_CHRONOS
 	struct list_head chronos_queue[MAX_RT_PRIO];
+	/* Priorities whose partition window is closed on this CPU */
+	DECLARE_BITMAP(chronos_closed, MAX_RT_PRIO);
 #endif
 #if defined CONFIG_SMP || defined CONFIG_RT_GROUP_SCHED
 	struct {
@@ -419,6 +421,8 @@ struct rt_rq {
 #ifdef CONFIG_CHRONOS
 	struct rt_sched_local *chronos_local;
 	struct global_sched_domain *chronos_global;
+	/* Local schedulers of the priorities run by servers, if not the above */
+	struct rt_sched_local *chronos_child[MAX_RT_PRIO];
 #endif
 };
 
@@ -586,6 +590,7 @@ struct rq {
 	unsigned int sched_ipi_received;
 	unsigned int sched_ipi_missed;
 	unsigned int sched_ipi_waiting;
+	unsigned int sched_preempt_deferred;
 	unsigned int task_pulled_from;
 	unsigned int task_pulled_to;
 	unsigned int task_pull_failed;
@@ -597,6 +602,8 @@ struct rq {
 	/* Indicates the behavior of a thread upon receiving 
 	 * a scheduling IPI */
 	atomic_t must_block;
+	/* Ends a preemption held back for a non-preemptive region */
+	struct hrtimer np_timer;
 #endif
 };
 
@@ -1821,6 +1828,59 @@ static const struct sched_class rt_sched_class;
 #include "chronos_sched_stats.c"
 
 #ifdef CONFIG_CHRONOS
+static enum hrtimer_restart np_timer_fn(struct hrtimer *timer)
+{
+	struct rq *rq = container_of(timer, struct rq, np_timer);
+
+	chronos_resched_cpu(cpu_of(rq));
+	return HRTIMER_NORESTART;
+}
+
+/* Limited preemption: a ChronOS task inside a non-preemptive region keeps
+ * its CPU when asked to reschedule, for at most its np_budget after the
+ * first request, and never longer than sysctl_chronos_np_budget_max. Only np
+ * is taken from the shared page; the task cannot extend the budget by
+ * clearing delayed. Returns 1 if the preemption was held back.
+ */
+static int defer_preemption(struct rq *rq, struct task_struct *p)
+{
+	struct rt_info *r = &p->rtinfo;
+	struct np_ctrl *ctrl = r->np_ctrl;
+	unsigned long budget = min_t(unsigned long, r->np_budget,
+				     sysctl_chronos_np_budget_max);
+	u64 now;
+
+	if(p->policy != SCHED_CHRONOS || !ctrl || !budget ||
+	   !ACCESS_ONCE(ctrl->np))
+		return 0;
+
+	now = ktime_to_ns(ktime_get());
+	if(!r->np_deferred) {
+		r->np_deferred = 1;
+		r->np_until = now + (u64)budget * NSEC_PER_USEC;
+		hrtimer_start(&rq->np_timer, ns_to_ktime(r->np_until),
+			      HRTIMER_MODE_ABS);
+		cschedstat_inc(rq, sched_preempt_deferred);
+	} else if(now >= r->np_until)
+		return 0;
+
+	ctrl->delayed = 1;
+	return 1;
+}
+
+/* The task is being switched out, so any held back preemption is done */
+static void end_deferred_preemption(struct rq *rq, struct task_struct *prev)
+{
+	struct rt_info *r = &prev->rtinfo;
+
+	if(r->np_deferred) {
+		r->np_deferred = 0;
+		if(r->np_ctrl)
+			r->np_ctrl->delayed = 0;
+		hrtimer_try_to_cancel(&rq->np_timer);
+	}
+}
+
 int prio_resched_cpu(int cpu, int prio)
 {
 	unsigned long flags;
@@ -1833,6 +1893,11 @@ int prio_resched_cpu(int cpu, int prio)
 		return 0;
 
 	p = rq->curr;
+	if(defer_preemption(rq, p)) {
+		raw_spin_unlock_irqrestore(&rq->lock, flags);
+		return 0;
+	}
+
 	set_tsk_need_resched(p);
 
 	/* If the CPU's must_block flag is unset, set it to block, and send an
@@ -1852,12 +1917,174 @@ int prio_resched_cpu(int cpu, int prio)
 	return ret;
 }
 
-/* Normally we should lock this, but right now we only ever abort from one point
- * and that point is locked, so it should be fine
+/* Force a CPU to run the global scheduler at its next scheduling point,
+ * rather than blocking on whichever CPU last scheduled globally. This can be
+ * called while holding another runqueue lock, so never spin on the lock.
+ */
+void chronos_resched_cpu(int cpu)
+{
+	unsigned long flags;
+	struct rq *rq = cpu_rq(cpu);
+
+	atomic_set(&rq->must_block, BLOCK_FLAG_CANNOT_FORCE_BLOCK);
+
+	if(raw_spin_trylock_irqsave(&rq->lock, flags)) {
+		resched_task(rq->curr);
+		raw_spin_unlock_irqrestore(&rq->lock, flags);
+	} else {
+		set_tsk_need_resched(rq->curr);
+		if(cpu != raw_smp_processor_id())
+			smp_send_reschedule(cpu);
+	}
+}
+EXPORT_SYMBOL(chronos_resched_cpu);
+
+/* The module that is switching windows, see chronos_claim_window() */
+static const char *chronos_window_owner;
+
+/* Temporal partitioning and hierarchical servers both drive the closed
+ * priorities of the CPUs, so only one of them may do so at a time. A module
+ * claims the windows before it starts, and gets -EBUSY if another has them.
+ */
+int chronos_claim_window(const char *owner)
+{
+	const char *old = cmpxchg(&chronos_window_owner, NULL, owner);
+
+	return old && old != owner ? -EBUSY : 0;
+}
+EXPORT_SYMBOL(chronos_claim_window);
+
+void chronos_release_window(const char *owner)
+{
+	cmpxchg(&chronos_window_owner, owner, NULL);
+}
+EXPORT_SYMBOL(chronos_release_window);
+
+/* Temporal partitioning: close the priorities set in closed on a CPU, so that
+ * nothing queued at them runs there, or open them all again if closed is NULL.
+ * Called at partition window boundaries, by the owner of the windows.
+ */
+void chronos_set_window(int cpu, const unsigned long *closed)
+{
+	unsigned long flags;
+	struct rq *rq = cpu_rq(cpu);
+
+	raw_spin_lock_irqsave(&rq->lock, flags);
+	if(closed)
+		bitmap_copy(rq->rt.chronos_closed, closed, MAX_RT_PRIO);
+	else
+		bitmap_zero(rq->rt.chronos_closed, MAX_RT_PRIO);
+	raw_spin_unlock_irqrestore(&rq->lock, flags);
+
+	chronos_resched_cpu(cpu);
+}
+EXPORT_SYMBOL(chronos_set_window);
+
+/* Whether a CPU is running a single ChronOS task with nothing else queued, and
+ * so can do without the tick. Called from the CPU's own tick.
+ */
+int sched_chronos_single(int cpu)
+{
+	struct rq *rq = cpu_rq(cpu);
+
+	return rq->nr_running == 1 && rq->curr->policy == SCHED_CHRONOS;
+}
+
+/* Whether the task running on a CPU is in a ChronOS segment. Only a snapshot,
+ * for benchmarks and statistics. */
+int chronos_cpu_in_segment(int cpu)
+{
+	int ret;
+
+	rcu_read_lock();
+	ret = cpu_curr(cpu)->policy == SCHED_CHRONOS;
+	rcu_read_unlock();
+
+	return ret;
+}
+EXPORT_SYMBOL(chronos_cpu_in_segment);
+
+/* As task_sched_runtime(), for schedulers, which hold runqueue locks already
+ * and so cannot take that of p. If p is running, the time since its CPU last
+ * updated its clock is added from sched_clock_cpu().
+ */
+unsigned long long chronos_task_runtime(struct task_struct *p)
+{
+	struct rq *rq = task_rq(p);
+	u64 ns = p->se.sum_exec_runtime;
+	s64 delta;
+
+	if(task_current(rq, p)) {
+		delta = (s64)(rq->clock_task - p->se.exec_start) +
+			(s64)(sched_clock_cpu(cpu_of(rq)) - rq->clock);
+		if(delta > 0)
+			ns += delta;
+	}
+
+	return ns;
+}
+EXPORT_SYMBOL(chronos_task_runtime);
+
+/* A segment's deadline timer has fired. Fail the segment now, rather than
+ * whenever a scheduler next gets round to checking it, and have its domain
+ * schedule again so that the abort is acted on straight away. If the segment
+ * goes on to run its abort handler the timer is re-armed for the handler's
+ * deadline, and the handler fails in turn if it is still running then.
+ * A failed task is put at the head of its local queue, so that
+ * presched_abort_generic() finds it without a scan.
+ */
+enum hrtimer_restart chronos_deadline_timer(struct hrtimer *timer)
+{
+	struct rt_info *r = container_of(timer, struct rt_info, deadline_timer);
+	struct task_struct *p = task_of_rtinfo(r);
+	enum hrtimer_restart ret = HRTIMER_NORESTART;
+	struct global_sched_domain *g;
+	unsigned long flags;
+	struct rq *rq;
+	int cpu;
+
+	rq = task_rq_lock(p, &flags);
+	cpu = cpu_of(rq);
+
+	if(p->policy == SCHED_CHRONOS) {
+		g = rq->rt.chronos_global;
+		if(g && in_global_list(r))
+			raw_spin_lock(&g->global_task_list_lock);
+		else
+			g = NULL;
+
+		if(!check_task_aborted(r))
+			handle_task_failure(r, rq->rt.chronos_local->flags);
+		else
+			r->local_ivd = -1;
+
+		if(r->local_ivd != -1 && !is_zero_ts(&r->deadline)) {
+			hrtimer_set_expires(timer, timespec_to_ktime(r->deadline));
+			ret = HRTIMER_RESTART;
+		} else if(r->local_ivd == -1 && !list_empty(&r->task_list[LOCAL_LIST]))
+			list_move(&r->task_list[LOCAL_LIST], rq->rt.chronos_queue + p->prio);
+
+		if(g) {
+			g->queue_stamp++;
+			raw_spin_unlock(&g->global_task_list_lock);
+		}
+	}
+
+	task_rq_unlock(rq, p, &flags);
+
+	chronos_resched_cpu(cpu);
+	return ret;
+}
+
+/* Called with a runqueue locked, either by a scheduler or by
+ * chronos_deadline_timer(), which holds the task's own. A scheduler may abort
+ * a task queued on another CPU, so the schedstat can race; it is only a
+ * statistic, and the cgroup count is atomic.
  */
 void inc_abort_count(struct task_struct *p)
 {
 	cschedstat_inc(task_rq(p), seg_abort_count);
+	chronos_cgroup_miss(p);
 }
 #endif
 
@@ -4479,6 +4706,7 @@ need_resched:
 		idle_balance(cpu, rq);
 #ifdef CONFIG_CHRONOS
 	check_global_insert(prev, rq->rt.chronos_global);
+	end_deferred_preemption(rq, prev);
 #endif
 	put_prev_task(rq, prev);
 
@@ -4507,6 +4735,9 @@ need_resched:
 		rq->curr = next;
 		++*switch_count;
 
+#ifdef CONFIG_CHRONOS
+		tick_chronos_restart();
+#endif
 		context_switch(rq, prev, next); /* unlocks the rq */
 		/*
 		 * The context switch have flipped the stack from under us
@@ -5156,6 +5387,80 @@ void task_setprio(struct task_struct *p, int prio)
 out_unlock:
 	__task_rq_unlock(rq);
 }
+
+#ifdef CONFIG_CHRONOS
+/* Requeue a task whose keys have changed, called with its rq locked */
+static void requeue_chronos_keys(struct rq *rq, struct task_struct *p)
+{
+	struct rt_info *r = &p->rtinfo;
+	struct global_sched_domain *g;
+
+	if(p->policy == SCHED_CHRONOS && !list_empty(&r->task_list[LOCAL_LIST])) {
+		dequeue_chronos(p);
+		enqueue_chronos(rq, p);
+	}
+
+	g = rq->rt.chronos_global;
+	if(g) {
+		raw_spin_lock(&g->global_task_list_lock);
+		if(in_global_list(r)) {
+			list_del_init(&r->task_list[GLOBAL_LIST]);
+			insert_on_global_queue(r, &g->global_task_list,
+					       g->scheduler->base.sort_key);
+			g->queue_stamp++;
+		}
+		raw_spin_unlock(&g->global_task_list_lock);
+	}
+
+	if(p->on_rq)
+		resched_task(rq->curr);
+}
+
+/*
+ * task_setpiinfo - set the ChronOS keys a task inherits
+ * @p: task
+ * @pi: the deadline and period inherited from its waiters
+ *
+ * Requeues the task in chronos_queue and in the global task list so that it
+ * is ordered by the new keys. The rt_mutex counterpart of task_setprio() for
+ * SCHED_CHRONOS tasks, called with p->pi_lock held.
+ */
+void task_setpiinfo(struct task_struct *p, struct pi_info *pi)
+{
+	struct rq *rq;
+
+	rq = __task_rq_lock(p);
+	p->rtinfo.piinfo = *pi;
+	requeue_chronos_keys(rq, p);
+	__task_rq_unlock(rq);
+}
+
+/*
+ * task_inherit_deadline - give a task the keys of another
+ * @p: task
+ * @from: the task whose (possibly inherited) deadline and period it takes
+ *
+ * Used for irq threads, which run by the deadline of the task waiting on
+ * them. Safe from hard irq context.
+ */
+void task_inherit_deadline(struct task_struct *p, struct task_struct *from)
+{
+	struct rt_info *r = &p->rtinfo;
+	unsigned long flags;
+	struct rq *rq;
+
+	rq = task_rq_lock(p, &flags);
+
+	r->deadline = *pi_deadline(&from->rtinfo);
+	r->temp_deadline = r->deadline;
+	r->period = *pi_period(&from->rtinfo);
+	r->local_ivd = from->rtinfo.local_ivd;
+	r->global_ivd = from->rtinfo.global_ivd;
+	requeue_chronos_keys(rq, p);
+
+	task_rq_unlock(rq, p, &flags);
+}
+#endif
 #endif
 
 void set_user_nice(struct task_struct *p, long nice)
@@ -5867,6 +6172,104 @@ SYSCALL_DEFINE0(sched_yield)
 }
 
 #ifdef CONFIG_CHRONOS
+/* Serializes domain changes */
+static DEFINE_MUTEX(chronos_domain_mutex);
+
+/* Whether a CPU uses a local scheduler, for itself or for a server */
+static int local_in_use(struct rq *rq, struct rt_sched_local *l)
+{
+	int prio;
+
+	if(rq->rt.chronos_local == l)
+		return 1;
+
+	for(prio = 0; prio < MAX_RT_PRIO; prio++) {
+		if(rq->rt.chronos_child[prio] == l)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Whether a CPU has servers with local schedulers of their own */
+static int has_child_locals(struct rq *rq)
+{
+	int prio;
+
+	for(prio = 0; prio < MAX_RT_PRIO; prio++) {
+		if(rq->rt.chronos_child[prio])
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Have the tasks at a ChronOS priority on a CPU scheduled by their own local
+ * scheduler, or by the CPU's again if l is NULL. Used by hierarchical
+ * scheduling, where each server runs a child policy. Removing the scheduler
+ * resets the CPU, as for any other local scheduler.
+ */
+int chronos_set_child_local(int cpu, int prio, struct rt_sched_local *l)
+{
+	unsigned long flags;
+	struct rq *rq = cpu_rq(cpu);
+	struct rt_sched_local *old;
+
+	if(prio < 0 || prio >= MAX_RT_PRIO)
+		return -EINVAL;
+
+	mutex_lock(&chronos_domain_mutex);
+	raw_spin_lock_irqsave(&rq->lock, flags);
+
+	old = rq->rt.chronos_child[prio];
+	rq->rt.chronos_child[prio] = l;
+	if(old && !local_in_use(rq, old))
+		cpumask_clear_cpu(cpu, &old->base.active_mask);
+	if(l)
+		cpumask_set_cpu(cpu, &l->base.active_mask);
+
+	raw_spin_unlock_irqrestore(&rq->lock, flags);
+	mutex_unlock(&chronos_domain_mutex);
+
+	chronos_resched_cpu(cpu);
+	return 0;
+}
+EXPORT_SYMBOL(chronos_set_child_local);
+
+/* Tasks that begin a segment are counted on the domain of their CPU before
+ * they are put on its list, at their next schedule. Move the count of those
+ * on a CPU along with it, or drop the insert if the new domain does not
+ * schedule them globally. The runqueue must be locked.
+ */
+static void migrate_global_inserts(struct rq *rq, struct global_sched_domain *from,
+				   struct global_sched_domain *to)
+{
+	struct rt_info *it;
+	int keep = to && to->prio == from->prio;
+
+	list_for_each_entry(it, rq->rt.chronos_queue + get_global_chronos_sys_prio(from),
+			    task_list[LOCAL_LIST]) {
+		if(!task_check_flag(it, INSERT_GLOBAL))
+			continue;
+
+		atomic_dec(&from->tasks);
+		if(keep)
+			atomic_inc(&to->tasks);
+		else
+			clear_global_insert(it);
+	}
+}
+
+/* Domains are published to the runqueues with RCU. Schedulers only look at
+ * rq->rt.chronos_global with the runqueue locked or preemption disabled, so
+ * one that is still running on an old domain keeps it until a sched grace
+ * period has passed. Each CPU switches to the new domain first and then
+ * hands its tasks over under the old task list lock only: with its runqueue
+ * locked it cannot be scheduling, and CPUs left in the old domain that map a
+ * task to it from the old mask are done after that grace period. A CPU whose
+ * servers have child schedulers is refused with -EBUSY, as the servers module
+ * would not know they had gone; the servers have to be cleared first.
+ */
 int set_scheduler_mask(struct rt_sched_local *l, struct rt_sched_global *g,
 	cpumask_var_t new_mask, int prio)
 {
@@ -5875,10 +6278,21 @@ int set_scheduler_mask(struct rt_sched_local *l, struct rt_sched_global *g,
 	struct rq *rq;
 	struct global_sched_domain *domain = NULL, *old_domain;
 
+	mutex_lock(&chronos_domain_mutex);
+
+	for_each_cpu(i, new_mask) {
+		if(has_child_locals(cpu_rq(i))) {
+			mutex_unlock(&chronos_domain_mutex);
+			return -EBUSY;
+		}
+	}
+
 	if(g) {
 		domain = create_global_domain(g, prio);
-		if(!domain)
+		if(!domain) {
+			mutex_unlock(&chronos_domain_mutex);
 			return -ENOMEM;
+		}
 
 		cpumask_copy(&domain->global_sched_mask, new_mask);
 		add_global_domain(domain);
@@ -5889,30 +6303,21 @@ int set_scheduler_mask(struct rt_sched_local *l, struct rt_sched_global *g,
 		if(!rq)
 			continue;
 
-		/* If this cpu was already in a domain, we need to make sure that
-		 * we don't remove it while it is still being accessed and make
-		 * sure we delete the domain properly
-		 */
-		local_irq_save(flags);
-		raw_spin_lock(&rq->lock);
+		raw_spin_lock_irqsave(&rq->lock, flags);
 		old_domain = rq->rt.chronos_global;
 
+		/* Set the new scheduler/domain */
+		rcu_assign_pointer(rq->rt.chronos_global, domain);
+
 		if(old_domain) {
-			/* Make sure CPU i isn't scheduling or in any other way
-			 * touching the domain when we remove it */
-			lock_global_sched_lock(old_domain);
+			/* Take its queued and about to be queued tasks along,
+			 * and remove this cpu from the mask */
 			lock_global_task_list(old_domain);
-			/* Remove this cpu from the mask */
 			cpumask_clear_cpu(i, &old_domain->global_sched_mask);
 			cpumask_clear_cpu(i, &old_domain->scheduler->base.active_mask);
-		}
-
-		/* Set the new scheduler/domain */
-		rq->rt.chronos_global = domain;
-
-		if(old_domain) {
+			_migrate_global_tasks(old_domain, domain, i);
 			unlock_global_task_list(old_domain);
-			unlock_global_sched_lock(old_domain);
+			migrate_global_inserts(rq, old_domain, domain);
 		}
 
 		cpumask_clear_cpu(i, &rq->rt.chronos_local->base.active_mask);
@@ -5932,15 +6337,33 @@ int set_scheduler_mask(struct rt_sched_local *l, struct rt_sched_global *g,
 		/* If CPU i was the last CPU using this domain, delete it.
 		 * Do this here so that we can leave this an rtmutex.
 		 */
-		if(old_domain && count_global_cpus(old_domain) == 0) {
-			remove_global_domain(old_domain);
-			kfree(old_domain);
-		}
+		if(old_domain && count_global_cpus(old_domain) == 0)
+			free_global_domain(old_domain);
+
+	}
+
+	mutex_unlock(&chronos_domain_mutex);
+
+	/* An old domain may have mapped a task to the CPUs before they left
+	 * its mask; forget those once it can no longer be doing so */
+	synchronize_sched();
+	for_each_cpu(i, new_mask) {
+		rq = cpu_rq(i);
+		raw_spin_lock_irqsave(&rq->lock, flags);
+		if(rq->rt.chronos_global == domain)
+			cpu_init_global_domain(i);
+		raw_spin_unlock_irqrestore(&rq->lock, flags);
+	}
 
+	/* Have the new domain pick up the tasks it was handed */
+	if(domain) {
+		for_each_cpu(i, new_mask)
+			chronos_resched_cpu(i);
 	}
 
 	return 0;
 }
+EXPORT_SYMBOL(set_scheduler_mask);
 
 int set_scheduler_mask_user(struct rt_sched_local *l, struct rt_sched_global *g,
 	unsigned int len, unsigned long __user *user_mask_ptr, int prio)
@@ -5957,7 +6380,7 @@ int set_scheduler_mask_user(struct rt_sched_local *l, struct rt_sched_global *g,
 
 	cpumask_and(new_mask, new_mask, cpu_online_mask);
 
-	set_scheduler_mask(l, g, new_mask, prio);
+	retval = set_scheduler_mask(l, g, new_mask, prio);
 
 out_free:
 	free_cpumask_var(new_mask);
@@ -8398,8 +8821,13 @@ static void init_rt_rq(struct rt_rq *rt_rq, struct rq *rq)
 #endif
 #ifdef CONFIG_CHRONOS
 	chronos_init_cpu(cpu_of(rq));
+	hrtimer_init(&rq->np_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	rq->np_timer.function = np_timer_fn;
+	rq->np_timer.irqsafe = 1;
 	rt_rq->chronos_local = &fifo;
 	rt_rq->chronos_global = NULL;
+	bitmap_zero(rt_rq->chronos_closed, MAX_RT_PRIO);
+	memset(rt_rq->chronos_child, 0, sizeof(rt_rq->chronos_child));
 #endif
 }
 
@@ -10,7 +10,7 @@ static void deactivate_task(struct rq *rq, struct task_struct *p, int sleep);
 #endif
 
 #ifdef CONFIG_CHRONOS
-static int rq_sort_key(struct rq *rq);
+static int rq_sort_key(struct rq *rq, int prio);
 #endif
 #ifdef CONFIG_RT_GROUP_SCHED
 
@@ -978,7 +978,34 @@ static void dequeue_rt_entity(struct sched_rt_entity *rt_se)
 #ifdef CONFIG_CHRONOS
 static void enqueue_chronos(struct rq *rq, struct task_struct *p)
 {
-	insert_on_local_queue(&p->rtinfo, rq->rt.chronos_queue + p->prio, rq_sort_key(rq));
+	insert_on_local_queue(&p->rtinfo, rq->rt.chronos_queue + p->prio, rq_sort_key(rq, p->prio));
+}
+
+/* Work stealing: have one idle or lower priority peer of rq come and steal */
+static void kick_stealer(struct rq *rq, struct global_sched_domain *g, int prio)
+{
+	int cpu;
+
+	for_each_cpu_mask(cpu, g->global_sched_mask) {
+		if(cpu != cpu_of(rq) && cpu_rq(cpu)->curr->prio > prio) {
+			prio_resched_cpu(cpu, prio + 1);
+			break;
+		}
+	}
+}
+
+/* A task queued in a work stealing domain that will not preempt the CPU it
+ * woke on waits there, so have a peer steal it now rather than when this CPU
+ * next schedules */
+static void steal_on_enqueue(struct rq *rq, struct task_struct *p)
+{
+	struct global_sched_domain *g = rq->rt.chronos_global;
+
+	if(!g || g->scheduler->preschedule != presched_steal ||
+	   p->prio != get_global_chronos_sys_prio(g) || rq->curr->prio > p->prio)
+		return;
+
+	kick_stealer(rq, g, p->prio);
 }
 
 static void dequeue_chronos(struct task_struct *p)
@@ -990,7 +1017,7 @@ static void requeue_chronos(struct rq *rq, struct task_struct *p, int head)
 {
 	struct list_head *queue = rq->rt.chronos_queue + p->prio;
 	struct list_head *task = &p->rtinfo.task_list[LOCAL_LIST];
-	if (!list_empty(task) && (rq_sort_key(rq) == SORT_KEY_NONE)) {
+	if (!list_empty(task) && (rq_sort_key(rq, p->prio) == SORT_KEY_NONE)) {
 		if (head)
 			list_move(task, queue);
 		else
@@ -998,15 +1025,28 @@ static void requeue_chronos(struct rq *rq, struct task_struct *p, int head)
 	}
 }
 
-static int rq_sort_key(struct rq *rq)
+/* The local scheduler for a priority, that of its server if it has one */
+static inline struct rt_sched_local *rq_local(struct rt_rq *rt_rq, int prio)
 {
-	return rq->rt.chronos_local->base.sort_key;
+	struct rt_sched_local *l = rt_rq->chronos_child[prio];
+
+	return l ? l : rt_rq->chronos_local;
+}
+
+static int rq_sort_key(struct rq *rq, int prio)
+{
+	return rq_local(&rq->rt, prio)->base.sort_key;
 }
 
 /* Handle removing the task from the ChronOS global queue from do_exit() */
 void exit_chronos(struct task_struct *t) {
-	struct global_sched_domain *domain = task_rq(t)->rt.chronos_global;
+	struct global_sched_domain *domain;
+
+	/* The domain may be switched under us, but is not freed before this */
+	rcu_read_lock_sched();
+	domain = rcu_dereference_sched(task_rq(t)->rt.chronos_global);
 	test_remove_task_global(&t->rtinfo, domain);
+	rcu_read_unlock_sched();
 }
 #endif
 
@@ -1021,8 +1061,11 @@ enqueue_task_rt(struct rq *rq, struct task_struct *p, int flags)
 	enqueue_rt_entity(rt_se, flags & ENQUEUE_HEAD);
 
 #ifdef CONFIG_CHRONOS
-	if(p->policy == SCHED_CHRONOS)
+	if(p->policy == SCHED_CHRONOS) {
 		enqueue_chronos(rq, p);
+		if(!task_current(rq, p))
+			steal_on_enqueue(rq, p);
+	}
 #endif
 
 	if (!task_current(rq, p) && p->rt.nr_cpus_allowed > 1)
@@ -1203,6 +1246,23 @@ static int chronos_lock_balance(struct rq *this_rq, struct rq *busiest)
 	return ret;
 }
 
+/* Charge a task, once a segment, for dragging its working set across nodes,
+ * and recompute its value densities so that schedulers see the longer
+ * execution time. Called before it is queued on the new CPU. */
+static void charge_migration(struct rt_info *r, int from, int to)
+{
+	if(r->migration_charged || !sysctl_chronos_migration_penalty ||
+	   cpu_to_node(from) == cpu_to_node(to))
+		return;
+
+	r->migration_charged = 1;
+	r->exec_time += sysctl_chronos_migration_penalty;
+	if(r->local_ivd != -1) {
+		r->local_ivd = r->max_util == 0 ? LONG_MAX : r->exec_time/r->max_util;
+		r->global_ivd = r->local_ivd;
+	}
+}
+
 static struct task_struct * _pull_global_task(struct rq *this_rq, struct task_struct *t)
 {
 	int this_cpu = cpu_of(this_rq), src_cpu = task_cpu(t);
@@ -1230,7 +1290,9 @@ static struct task_struct * _pull_global_task(struct rq *this_rq, struct task_st
 	deactivate_task(src_rq, t, 0);
 	set_task_cpu(t, this_cpu);
 	t->rtinfo.cpu = this_cpu;
+	charge_migration(&t->rtinfo, src_cpu, this_cpu);
 	activate_task(this_rq, t, 0);
+	chronos_cgroup_migrated(t);
 
 unlock:
 	double_unlock_balance(this_rq, src_rq);
@@ -1255,6 +1317,102 @@ static struct task_struct * pull_global_task(struct rq *this_rq)
 	return NULL;
 }
 
+/*
+ * Work stealing -- a domain's tasks stay queued on the CPU they woke on, and
+ * each CPU runs its own. A CPU with none of its own at the domain's priority
+ * steals the best, by the domain's sort key, that a peer has queued but is not
+ * running, and a CPU with tasks waiting has one idle or lower priority peer
+ * come and steal. Only the two runqueues involved are locked, as in
+ * pull_rt_task(), so there is no domain-wide lock and no broadcast IPI.
+ */
+static struct rt_info * best_stealable(struct rq *rq, int prio, int key, int cpu)
+{
+	struct rt_info *it, *best = NULL;
+
+	list_for_each_entry(it, rq->rt.chronos_queue + prio, task_list[LOCAL_LIST]) {
+		if(!pick_rt_task(rq, task_of_rtinfo(it), cpu))
+			continue;
+		if(!best || compare_before(it, best, key))
+			best = it;
+	}
+
+	return best;
+}
+
+/* Preschedule for work stealing: run our own tasks first */
+struct rt_info * presched_steal(struct list_head *head)
+{
+	struct rq *rq = this_rq();
+	struct global_sched_domain *g = rq->rt.chronos_global;
+
+	if(list_empty(head))
+		return NULL;
+
+	if(!list_is_singular(head))
+		kick_stealer(rq, g, get_global_chronos_sys_prio(g));
+
+	return local_task(head->next);
+}
+EXPORT_SYMBOL(presched_steal);
+
+/* The stealing itself. The CPU never schedules the global list, so this
+ * always returns 0, leaving the local scheduler to pick from what it stole. */
+int init_steal(struct global_sched_domain *g, int block)
+{
+	struct rq *this_rq = this_rq(), *src_rq;
+	int this_cpu = cpu_of(this_rq), cpu;
+	int prio = get_global_chronos_sys_prio(g), key = g->scheduler->base.sort_key;
+	struct rt_info *r, *best = NULL;
+	struct task_struct *t;
+
+	for_each_cpu_mask(cpu, g->global_sched_mask) {
+		src_rq = cpu_rq(cpu);
+		if(cpu == this_cpu || list_empty(src_rq->rt.chronos_queue + prio))
+			continue;
+
+		chronos_lock_balance(this_rq, src_rq);
+
+		r = best_stealable(src_rq, prio, key, this_cpu);
+		if(!r || (best && !compare_before(r, best, key)))
+			goto skip;
+
+		/* As in pull_rt_task(), anything better found later is
+		 * stolen as well, and this one is left for others */
+		t = task_of_rtinfo(r);
+		cschedstat_inc(this_rq, task_pulled_to);
+		cschedstat_inc(src_rq, task_pulled_from);
+
+		deactivate_task(src_rq, t, 0);
+		set_task_cpu(t, this_cpu);
+		r->cpu = this_cpu;
+		charge_migration(r, cpu, this_cpu);
+		activate_task(this_rq, t, 0);
+		chronos_cgroup_migrated(t);
+
+		best = r;
+skip:
+		double_unlock_balance(this_rq, src_rq);
+	}
+
+	return 0;
+}
+
+/* Nothing queued at a priority whose partition window is closed runs here */
+static inline int prio_closed(struct rt_rq *rt_rq, int prio)
+{
+	return prio < MAX_RT_PRIO && test_bit(prio, rt_rq->chronos_closed);
+}
+
+/* The highest priority from idx on that has tasks and is open, or
+ * MAX_RT_PRIO if there is none */
+static int first_open_prio(struct rt_rq *rt_rq, int idx)
+{
+	while(prio_closed(rt_rq, idx))
+		idx = find_next_bit(rt_rq->active.bitmap, MAX_RT_PRIO, idx + 1);
+
+	return idx;
+}
+
 static struct rt_info * preschedule_global(struct global_sched_domain *domain,
 			struct list_head *queue, int prio, int chronos_prio)
 {
@@ -1302,6 +1460,7 @@ static struct sched_rt_entity *pick_next_rt_entity(struct rq *rq,
 	int idx;
 #ifdef CONFIG_CHRONOS
 	struct global_sched_domain *domain = rt_rq->chronos_global;
+	struct rt_sched_local *local;
 	struct list_head *rt_queue;
 	struct rt_info *p;
 	int flags, chronos_prio = get_global_chronos_sys_prio(domain);
@@ -1309,9 +1468,12 @@ static struct sched_rt_entity *pick_next_rt_entity(struct rq *rq,
 	idx = sched_find_first_bit(array->bitmap);
 	BUG_ON(idx >= MAX_RT_PRIO);
 #ifdef CONFIG_CHRONOS
+	idx = first_open_prio(rt_rq, idx);
+	if(idx == MAX_RT_PRIO)
+		return NULL;
 	rt_queue = rt_rq->chronos_queue + idx;
 
-	if(chronos_prio > idx)
+	if(chronos_prio > idx || prio_closed(rt_rq, chronos_prio))
 		goto local;
 
 	/* Preschedule for the global schedule */
@@ -1329,17 +1491,28 @@ static struct sched_rt_entity *pick_next_rt_entity(struct rq *rq,
 	if(!rt_rq->rt_nr_running)
 		return NULL;
 
-	idx = sched_find_first_bit(array->bitmap);
+	idx = first_open_prio(rt_rq, sched_find_first_bit(array->bitmap));
+	if(idx == MAX_RT_PRIO)
+		return NULL;
 	rt_queue = rt_rq->chronos_queue + idx;
 
-local:	/* Locally schedule tasks */
-	if(!list_empty(rt_queue)) {
+local:	/* Locally schedule tasks. A local scheduler may decline to run any of
+	 * its tasks, e.g. in an idle slot of a table, in which case the next
+	 * open priority below gets the CPU. */
+	while(!list_empty(rt_queue)) {
 		cschedstat_inc(rq, sched_count_local);
-		flags = rt_rq->chronos_local->flags;
-		p = rt_rq->chronos_local->schedule(rt_queue, flags);
-		if(unlikely(!p))
+		local = rq_local(rt_rq, idx);
+		flags = local->flags;
+		p = local->schedule(rt_queue, flags);
+		if(likely(p)) {
+			requeue_task_rt(rq, task_of_rtinfo(p), 1);
+			break;
+		}
+
+		idx = first_open_prio(rt_rq, find_next_bit(array->bitmap, MAX_RT_PRIO, idx + 1));
+		if(idx == MAX_RT_PRIO)
 			return NULL;
-		requeue_task_rt(rq, task_of_rtinfo(p), 1);
+		rt_queue = rt_rq->chronos_queue + idx;
 	}
 #endif
 	queue = array->queue + idx;
@@ -1358,15 +1531,22 @@ static struct task_struct *_pick_next_task_rt(struct rq *rq)
 #endif
 	if (unlikely(!rt_rq->rt_nr_running)) {
 #ifdef CONFIG_CHRONOS
-		if(global_tasks(domain)) {
+		if(global_tasks(domain) &&
+		   !prio_closed(rt_rq, get_global_chronos_sys_prio(domain))) {
 			p = schedule_global(domain, rq);
 			if(p)
 				goto out;
 		}
+		/* Tasks may have been stolen onto this CPU instead */
+		if(rt_rq->rt_nr_running)
+			goto pick;
 #endif
 		return p;
 	}
 
+#ifdef CONFIG_CHRONOS
+pick:
+#endif
 	if (rt_rq_throttled(rt_rq))
 		return NULL;
 
@@ -20,6 +20,7 @@
 #include <linux/profile.h>
 #include <linux/sched.h>
 #include <linux/module.h>
+#include <linux/chronos_sched.h>
 
 #include <asm/irq_regs.h>
 
@@ -35,6 +36,22 @@ static DEFINE_PER_CPU(struct tick_sched, tick_cpu_sched);
  */
 static ktime_t last_jiffies_update;
 
+#ifdef CONFIG_CHRONOS
+/*
+ * Number of CPUs running with a deferred tick. They leave the jiffies update
+ * to tick_do_timer_cpu, so while there are any it does not stop its tick in
+ * idle; otherwise jiffies could lag for up to sysctl_chronos_tick_defer.
+ */
+static atomic_t chronos_deferred_cpus = ATOMIC_INIT(0);
+
+static inline int tick_chronos_keeps_time(int cpu)
+{
+	return cpu == tick_do_timer_cpu && atomic_read(&chronos_deferred_cpus);
+}
+#else
+static inline int tick_chronos_keeps_time(int cpu) { return 0; }
+#endif
+
 struct tick_sched *tick_get_tick_sched(int cpu)
 {
 	return &per_cpu(tick_cpu_sched, cpu);
@@ -322,7 +339,7 @@ void tick_nohz_stop_sched_tick(int inidle)
 	} while (read_seqcount_retry(&xtime_seq, seq));
 
 	if (rcu_needs_cpu(cpu) || printk_needs_cpu(cpu) ||
-	    arch_needs_cpu(cpu)) {
+	    arch_needs_cpu(cpu) || tick_chronos_keeps_time(cpu)) {
 		next_jiffies = last_jiffies + 1;
 		delta_jiffies = 1;
 	} else {
@@ -713,6 +730,97 @@ void tick_check_idle(int cpu)
  * We rearm the timer until we get disabled by the idle code.
  * Called with interrupts disabled and timer->base->cpu_base->lock held.
  */
+#ifdef CONFIG_CHRONOS
+/*
+ * A CPU running a single ChronOS task can do without the tick: ChronOS
+ * deadlines, budgets and releases are all hrtimer events, so the tick only
+ * adds jitter. Such a CPU pushes its next tick out to the next timer wheel
+ * event and leaves timekeeping to the others, the timekeeping CPU then keeps
+ * its tick even in idle. CPUs with RCU, printk or
+ * softirq work keep ticking, and sysctl_chronos_tick_defer bounds the
+ * deferral, as grace periods and rt bandwidth enforcement still rely on the
+ * tick to make progress.
+ */
+static int tick_chronos_defer(struct tick_sched *ts, int cpu, int user)
+{
+	struct hrtimer *timer = &ts->sched_timer;
+	unsigned long seq, last_jiffies, delta_jiffies, max_jiffies;
+
+	max_jiffies = msecs_to_jiffies(sysctl_chronos_tick_defer);
+	if (!max_jiffies || tick_do_timer_cpu == cpu ||
+	    tick_do_timer_cpu == TICK_DO_TIMER_NONE ||
+	    !sched_chronos_single(cpu) || rcu_needs_cpu(cpu) ||
+	    printk_needs_cpu(cpu) || arch_needs_cpu(cpu) ||
+	    local_softirq_pending())
+		return 0;
+
+	do {
+		seq = read_seqcount_begin(&xtime_seq);
+		last_jiffies = jiffies;
+	} while (read_seqcount_retry(&xtime_seq, seq));
+
+	delta_jiffies = get_next_timer_interrupt(last_jiffies) - last_jiffies;
+	if (delta_jiffies > max_jiffies)
+		delta_jiffies = max_jiffies;
+	if (delta_jiffies <= 1)
+		return 0;
+
+	ts->chronos_deferred = 1;
+	atomic_inc(&chronos_deferred_cpus);
+	ts->chronos_user = user;
+	ts->chronos_jiffies = last_jiffies;
+	ts->chronos_tick = hrtimer_get_expires(timer);
+	hrtimer_add_expires_ns(timer, (delta_jiffies - 1) * ktime_to_ns(tick_period));
+
+	return 1;
+}
+
+/*
+ * update_process_times() accounts a single tick, charge the current task
+ * with the ones that were skipped
+ */
+static void tick_chronos_account(struct tick_sched *ts)
+{
+	unsigned long ticks = jiffies - ts->chronos_jiffies;
+
+	ts->chronos_deferred = 0;
+	atomic_dec(&chronos_deferred_cpus);
+	if (ticks < 2 || ticks >= LONG_MAX)
+		return;
+
+	while (--ticks)
+		account_process_tick(current, ts->chronos_user);
+}
+
+/**
+ * tick_chronos_restart - bring back a deferred tick
+ *
+ * Called with the runqueue locked when the CPU switches tasks, so the timer
+ * is restarted without waking the softirq. The timer is still queued, so
+ * the new expiry is worked out here and only handed to the timer code, which
+ * requeues it under the base lock.
+ */
+void tick_chronos_restart(void)
+{
+	struct tick_sched *ts = &__get_cpu_var(tick_cpu_sched);
+	ktime_t now = ktime_get(), expires = ts->chronos_tick;
+	s64 period = ktime_to_ns(tick_period);
+
+	if (!ts->chronos_deferred)
+		return;
+
+	tick_chronos_account(ts);
+
+	/* The first tick of the original grid that is still to come */
+	if (expires.tv64 <= now.tv64)
+		expires = ktime_add_ns(expires, (div64_u64(ktime_to_ns(ktime_sub(now, expires)),
+							   period) + 1) * period);
+
+	__hrtimer_start_range_ns(&ts->sched_timer, expires, 0,
+				 HRTIMER_MODE_ABS_PINNED, 0);
+}
+#endif
+
 static enum hrtimer_restart tick_sched_timer(struct hrtimer *timer)
 {
 	struct tick_sched *ts =
@@ -754,11 +862,19 @@ static enum hrtimer_restart tick_sched_timer(struct hrtimer *timer)
 			touch_softlockup_watchdog();
 			ts->idle_jiffies++;
 		}
+#ifdef CONFIG_CHRONOS
+		if (ts->chronos_deferred)
+			tick_chronos_account(ts);
+#endif
 		update_process_times(user_mode(regs));
 		profile_tick(CPU_PROFILING);
 	}
 
 	hrtimer_forward(timer, now, tick_period);
+#ifdef CONFIG_CHRONOS
+	if (regs)
+		tick_chronos_defer(ts, cpu, user_mode(regs));
+#endif
 
 	return HRTIMER_RESTART;
 }
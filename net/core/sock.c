@@ -132,6 +132,10 @@
 #include <net/tcp.h>
 #endif
 
+#ifdef CONFIG_CHRONOS
+#include <linux/chronos_util.h>
+#endif
+
 /*
  * Each address family might have different locking rules, so we have
  * one slock key per address family:
@@ -1113,6 +1117,18 @@ void sock_update_classid(struct sock *sk)
 EXPORT_SYMBOL(sock_update_classid);
 #endif
 
+#ifdef CONFIG_CHRONOS
+void sock_update_deadline(struct sock *sk)
+{
+	/* Packets queued later on, even from softirq, go out with this */
+	if (current->policy == SCHED_CHRONOS)
+		sk->sk_deadline = *pi_deadline(&current->rtinfo);
+	else
+		sk->sk_deadline.tv_sec = sk->sk_deadline.tv_nsec = 0;
+}
+EXPORT_SYMBOL(sock_update_deadline);
+#endif
+
 /**
  *	sk_alloc - All socket objects are allocated here
  *	@net: the applicable net namespace
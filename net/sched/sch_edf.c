@@ -0,0 +1,260 @@
+/*
+ * net/sched/sch_edf.c	Earliest Deadline First queueing discipline.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Copyright (C) 2009-2012 Virginia Tech Real Time Systems Lab
+ */
+
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/init.h>
+#include <linux/skbuff.h>
+#include <linux/slab.h>
+#include <linux/hash.h>
+#include <linux/list.h>
+#include <linux/rbtree.h>
+#include <linux/time.h>
+#include <net/netlink.h>
+#include <net/pkt_sched.h>
+#include <net/sock.h>
+
+/*	Earliest Deadline First queueing.
+
+	Every packet carries the deadline of the ChronOS task which last sent
+	on its socket (see sock_update_deadline()), and packets with a deadline
+	are dispatched earliest deadline first. Packets keep their order within
+	a socket: each socket with packets queued has a flow with its own FIFO,
+	found through a hash table, and the flows are kept in an rbtree ordered
+	by the deadline of the packet at their head, so both enqueue and dequeue
+	are O(log n). A flow is allocated when its socket's first packet is
+	queued, and freed again once it is empty.
+
+	Everything without a deadline is best effort and goes into a plain
+	FIFO, which is served whenever no packet with a deadline is waiting.
+
+	The qdisc takes the same options as pfifo, a limit in packets, which
+	must not be zero.
+ */
+
+#define EDF_FLOWS_LOG		8
+#define EDF_FLOWS		(1 << EDF_FLOWS_LOG)
+
+struct edf_skb_cb {
+	struct timespec	deadline;
+};
+
+struct edf_flow {
+	struct rb_node		node;
+	struct hlist_node	hash;
+	struct sock		*sk;
+	struct sk_buff		*head;
+	struct sk_buff		*tail;
+	struct timespec		deadline;	/* of head */
+};
+
+struct edf_sched_data {
+	struct rb_root		flows_root;
+	struct sk_buff_head	be;
+	struct hlist_head	flows[EDF_FLOWS];
+};
+
+static inline struct edf_skb_cb *edf_skb_cb(struct sk_buff *skb)
+{
+	qdisc_cb_private_validate(skb, sizeof(struct edf_skb_cb));
+	return (struct edf_skb_cb *)qdisc_skb_cb(skb)->data;
+}
+
+static void edf_flow_insert(struct edf_sched_data *q, struct edf_flow *flow)
+{
+	struct rb_node **p = &q->flows_root.rb_node, *parent = NULL;
+	struct edf_flow *it;
+
+	while (*p) {
+		parent = *p;
+		it = rb_entry(parent, struct edf_flow, node);
+		if (timespec_compare(&flow->deadline, &it->deadline) < 0)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+
+	rb_link_node(&flow->node, parent, p);
+	rb_insert_color(&flow->node, &q->flows_root);
+}
+
+/* The flow of a socket, allocating it if the socket has nothing queued */
+static struct edf_flow *edf_flow_get(struct edf_sched_data *q, struct sock *sk)
+{
+	struct hlist_head *bucket = &q->flows[hash_ptr(sk, EDF_FLOWS_LOG)];
+	struct hlist_node *n;
+	struct edf_flow *flow;
+
+	hlist_for_each_entry(flow, n, bucket, hash) {
+		if (flow->sk == sk)
+			return flow;
+	}
+
+	flow = kmalloc(sizeof(*flow), GFP_ATOMIC);
+	if (!flow)
+		return NULL;
+
+	flow->sk = sk;
+	flow->head = flow->tail = NULL;
+	hlist_add_head(&flow->hash, bucket);
+	return flow;
+}
+
+static int edf_enqueue(struct sk_buff *skb, struct Qdisc *sch)
+{
+	struct edf_sched_data *q = qdisc_priv(sch);
+	struct timespec *deadline = &edf_skb_cb(skb)->deadline;
+	struct edf_flow *flow;
+
+	if (unlikely(sch->q.qlen >= sch->limit))
+		return qdisc_drop(skb, sch);
+
+	if (skb->sk)
+		*deadline = skb->sk->sk_deadline;
+	else
+		deadline->tv_sec = deadline->tv_nsec = 0;
+
+	if (!deadline->tv_sec && !deadline->tv_nsec) {
+		__skb_queue_tail(&q->be, skb);
+	} else {
+		flow = edf_flow_get(q, skb->sk);
+		if (unlikely(!flow))
+			return qdisc_drop(skb, sch);
+
+		skb->next = NULL;
+		if (flow->head) {
+			flow->tail->next = skb;
+		} else {
+			flow->head = skb;
+			flow->deadline = *deadline;
+			edf_flow_insert(q, flow);
+		}
+		flow->tail = skb;
+	}
+
+	sch->q.qlen++;
+	sch->qstats.backlog += qdisc_pkt_len(skb);
+	return NET_XMIT_SUCCESS;
+}
+
+static struct sk_buff *edf_dequeue(struct Qdisc *sch)
+{
+	struct edf_sched_data *q = qdisc_priv(sch);
+	struct rb_node *node = rb_first(&q->flows_root);
+	struct edf_flow *flow;
+	struct sk_buff *skb;
+
+	if (node) {
+		flow = rb_entry(node, struct edf_flow, node);
+		rb_erase(node, &q->flows_root);
+
+		skb = flow->head;
+		flow->head = skb->next;
+		skb->next = NULL;
+
+		/* Requeue the flow by its new head */
+		if (flow->head) {
+			flow->deadline = edf_skb_cb(flow->head)->deadline;
+			edf_flow_insert(q, flow);
+		} else {
+			hlist_del(&flow->hash);
+			kfree(flow);
+		}
+	} else {
+		skb = __skb_dequeue(&q->be);
+		if (!skb)
+			return NULL;
+	}
+
+	sch->q.qlen--;
+	sch->qstats.backlog -= qdisc_pkt_len(skb);
+	qdisc_bstats_update(sch, skb);
+	return skb;
+}
+
+static void edf_reset(struct Qdisc *sch)
+{
+	struct sk_buff *skb;
+
+	while ((skb = edf_dequeue(sch)) != NULL)
+		kfree_skb(skb);
+}
+
+static int edf_change(struct Qdisc *sch, struct nlattr *opt)
+{
+	struct tc_fifo_qopt *ctl;
+
+	if (opt == NULL) {
+		sch->limit = qdisc_dev(sch)->tx_queue_len ? : 1;
+	} else {
+		ctl = nla_data(opt);
+		if (nla_len(opt) < sizeof(*ctl))
+			return -EINVAL;
+
+		if (!ctl->limit)
+			return -EINVAL;
+
+		sch->limit = ctl->limit;
+	}
+
+	return 0;
+}
+
+static int edf_init(struct Qdisc *sch, struct nlattr *opt)
+{
+	struct edf_sched_data *q = qdisc_priv(sch);
+	int i;
+
+	q->flows_root = RB_ROOT;
+	skb_queue_head_init(&q->be);
+	for (i = 0; i < EDF_FLOWS; i++)
+		INIT_HLIST_HEAD(&q->flows[i]);
+
+	return edf_change(sch, opt);
+}
+
+static int edf_dump(struct Qdisc *sch, struct sk_buff *skb)
+{
+	struct tc_fifo_qopt opt = { .limit = sch->limit };
+
+	NLA_PUT(skb, TCA_OPTIONS, sizeof(opt), &opt);
+	return skb->len;
+
+nla_put_failure:
+	return -1;
+}
+
+static struct Qdisc_ops edf_qdisc_ops __read_mostly = {
+	.id		=	"edf",
+	.priv_size	=	sizeof(struct edf_sched_data),
+	.enqueue	=	edf_enqueue,
+	.dequeue	=	edf_dequeue,
+	.peek		=	qdisc_peek_dequeued,
+	.init		=	edf_init,
+	.reset		=	edf_reset,
+	.change		=	edf_change,
+	.dump		=	edf_dump,
+	.owner		=	THIS_MODULE,
+};
+
+static int __init edf_module_init(void)
+{
+	return register_qdisc(&edf_qdisc_ops);
+}
+static void __exit edf_module_exit(void)
+{
+	unregister_qdisc(&edf_qdisc_ops);
+}
+module_init(edf_module_init)
+module_exit(edf_module_exit)
+MODULE_LICENSE("GPL");
@@ -548,6 +548,7 @@ static inline int __sock_sendmsg_nosec(struct kiocb *iocb, struct socket *sock,
 	struct sock_iocb *si = kiocb_to_siocb(iocb);
 
 	sock_update_classid(sock->sk);
+	sock_update_deadline(sock->sk);
 
 	si->sock = sock;
 	si->scm = NULL;